@@ -0,0 +1,182 @@
+#include "pch.h"
+#include "AnomalyDetector.h"
+
+#include <cmath>
+#include <cstdio>
+
+namespace
+{
+    // Samples an hourly baseline needs before it replaces the overall one (about 10 minutes)
+    const double MIN_HOURLY_SAMPLES = 600;
+
+    // Samples the overall baseline needs before anything is flagged (about 5 minutes)
+    const double MIN_OVERALL_SAMPLES = 300;
+
+    // Weight cap of the running statistics. Past it they behave like an exponential
+    // average, so the baselines follow slow changes in usage.
+    const double MAX_BASELINE_WEIGHT = 20000;
+
+    // Floor for the standard deviation, a very steady baseline would otherwise flag noise
+    const double MIN_STDDEV_WATTS = 0.5;
+
+    // CUSUM slack (in standard deviations) and alarm threshold. Drain three standard
+    // deviations above the baseline raises the alert after about 30 samples.
+    const double CUSUM_SLACK = 1.0;
+    const double CUSUM_THRESHOLD = 60;
+
+    // Samples this far above the baseline are kept out of it while not alerting
+    const double OUTLIER_Z = 3;
+
+    // Excluded samples in a row after which drain counts as the new normal (about 30 minutes),
+    // so a lasting heavier workload is learned instead of being flagged forever. The baselines
+    // are then limited to this weight so they catch up within tens of minutes, not hours.
+    const unsigned MAX_EXCLUDED_RUN = 1800;
+    const double RELEARN_WEIGHT = MIN_HOURLY_SAMPLES;
+
+    const wchar_t* const BASELINE_SECTION = L"drain_baseline";
+
+    // Ini key of an hourly baseline, hour 24 stands for the overall one
+    void GetBaselineKey(int hour, wchar_t (&key)[8])
+    {
+        if (hour < 24)
+            swprintf_s(key, L"h%02d", hour);
+        else
+            wcscpy_s(key, L"all");
+    }
+}
+
+void CAnomalyDetector::Baseline::Add(double value, double maxCount)
+{
+    if (count < maxCount)
+        count += 1;
+    double delta = value - mean;
+    mean += delta / count;
+    m2 += delta * (value - mean);
+
+    // Once capped, scale the squared deviations down with the same weight as the mean
+    if (count >= maxCount)
+        m2 -= m2 / count;
+}
+
+void CAnomalyDetector::Baseline::LimitWeight(double maxCount)
+{
+    // Keeps the variance while the mean follows new samples faster
+    if (count <= maxCount)
+        return;
+    m2 *= (maxCount - 1) / (count - 1);
+    count = maxCount;
+}
+
+CAnomalyDetector::CAnomalyDetector()
+{
+}
+
+const CAnomalyDetector::Baseline& CAnomalyDetector::GetBaseline(int hourOfDay) const
+{
+    const Baseline& hourly = m_hourly[hourOfDay % 24];
+    return hourly.count >= MIN_HOURLY_SAMPLES ? hourly : m_overall;
+}
+
+bool CAnomalyDetector::Update(double dischargeWatts, int hourOfDay)
+{
+    m_last_discharge = dischargeWatts;
+    m_last_hour = hourOfDay % 24;
+
+    // Charging or on AC power: there is no drain to judge
+    if (dischargeWatts <= 0)
+    {
+        ResetChangePoint();
+        m_acknowledged = false;
+        return false;
+    }
+
+    bool outlier = false;
+    if (m_overall.count >= MIN_OVERALL_SAMPLES)
+    {
+        const Baseline& baseline = GetBaseline(m_last_hour);
+        double stddev = sqrt(baseline.Variance());
+        if (stddev < MIN_STDDEV_WATTS)
+            stddev = MIN_STDDEV_WATTS;
+
+        double z = (dischargeWatts - baseline.mean) / stddev;
+        outlier = z > OUTLIER_Z;
+
+        // One-sided CUSUM, capped so an alert clears within bounded time once drain is normal
+        m_cusum += z - CUSUM_SLACK;
+        if (m_cusum < 0)
+            m_cusum = 0;
+        if (m_cusum > 2 * CUSUM_THRESHOLD)
+            m_cusum = 2 * CUSUM_THRESHOLD;
+
+        if (m_cusum > CUSUM_THRESHOLD && !m_acknowledged)
+            m_alerting = true;
+        else if (m_cusum == 0)
+        {
+            m_alerting = false;
+            m_acknowledged = false;
+        }
+    }
+
+    // Keep abnormal drain out of the baselines so a runaway process does not become normal,
+    // but only for a bounded time
+    if (m_acknowledged || (!m_alerting && !outlier))
+        m_excluded_run = 0;
+    else
+        ++m_excluded_run;
+
+    if (m_excluded_run == MAX_EXCLUDED_RUN + 1)
+    {
+        m_hourly[m_last_hour].LimitWeight(RELEARN_WEIGHT);
+        m_overall.LimitWeight(RELEARN_WEIGHT);
+    }
+    if (m_excluded_run == 0 || m_excluded_run > MAX_EXCLUDED_RUN)
+    {
+        m_hourly[m_last_hour].Add(dischargeWatts, MAX_BASELINE_WEIGHT);
+        m_overall.Add(dischargeWatts, MAX_BASELINE_WEIGHT);
+    }
+    return m_alerting;
+}
+
+void CAnomalyDetector::ResetChangePoint()
+{
+    m_cusum = 0;
+    m_alerting = false;
+    m_excluded_run = 0;
+}
+
+void CAnomalyDetector::Acknowledge()
+{
+    ResetChangePoint();
+    m_acknowledged = true;
+    m_hourly[m_last_hour].LimitWeight(RELEARN_WEIGHT);
+    m_overall.LimitWeight(RELEARN_WEIGHT);
+}
+
+void CAnomalyDetector::Save(const wchar_t* iniPath) const
+{
+    for (int hour = 0; hour <= 24; hour++)
+    {
+        const Baseline& baseline = hour < 24 ? m_hourly[hour] : m_overall;
+        wchar_t key[8], value[80];
+        GetBaselineKey(hour, key);
+        swprintf_s(value, L"%.17g,%.17g,%.17g", baseline.count, baseline.mean, baseline.m2);
+        WritePrivateProfileString(BASELINE_SECTION, key, value, iniPath);
+    }
+}
+
+void CAnomalyDetector::Load(const wchar_t* iniPath)
+{
+    for (int hour = 0; hour <= 24; hour++)
+    {
+        Baseline& baseline = hour < 24 ? m_hourly[hour] : m_overall;
+        wchar_t key[8], value[80];
+        GetBaselineKey(hour, key);
+        GetPrivateProfileString(BASELINE_SECTION, key, L"", value, _countof(value), iniPath);
+
+        // Skip missing or damaged entries rather than start from a nonsensical baseline
+        Baseline loaded;
+        if (swscanf_s(value, L"%lf,%lf,%lf", &loaded.count, &loaded.mean, &loaded.m2) == 3
+            && loaded.count >= 0 && loaded.count <= MAX_BASELINE_WEIGHT && loaded.m2 >= 0)
+            baseline = loaded;
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+// Streaming detector for abnormal battery drain. Each sample is compared with a running
+// baseline for the same hour of the day (online mean and variance), and a one-sided CUSUM
+// over the standardized excess raises the alert once the drain stays high. O(1) per sample.
+class CAnomalyDetector
+{
+public:
+    struct Baseline
+    {
+        double count = 0;   // Capped, so old samples fade out once it is reached
+        double mean = 0;
+        double m2 = 0;      // Sum of squared deviations from the mean
+
+        double Variance() const { return count > 1 ? m2 / (count - 1) : 0; }
+        void Add(double value, double maxCount);
+        void LimitWeight(double maxCount);
+    };
+
+    CAnomalyDetector();
+
+    // Feeds one sample. dischargeWatts is the power drawn from the battery, 0 or less when
+    // the system is not running on battery. Returns whether the alert is raised.
+    bool Update(double dischargeWatts, int hourOfDay);
+
+    // Drops the accumulated evidence but keeps the baselines and an acknowledgement, e.g. after resume
+    void ResetChangePoint();
+
+    // Clears a raised alert and accepts the current drain as normal: the samples go into the
+    // baselines and the alert stays off until the drain has dropped back to the baseline
+    void Acknowledge();
+
+    // Stores the baselines in the [drain_baseline] section of the ini file, or reads them back.
+    // Load() keeps the current baselines when the file has none.
+    void Save(const wchar_t* iniPath) const;
+    void Load(const wchar_t* iniPath);
+
+    bool IsAlerting() const { return m_alerting; }
+    double GetCusum() const { return m_cusum; }
+    double GetLastDischarge() const { return m_last_discharge; }
+    int GetLastHour() const { return m_last_hour; }
+
+    // Baseline used for the given hour: the hourly one once it has enough samples, otherwise
+    // the one over all hours
+    const Baseline& GetBaseline(int hourOfDay) const;
+
+private:
+    Baseline m_hourly[24];
+    Baseline m_overall;
+    double m_cusum = 0;
+    bool m_alerting = false;
+    bool m_acknowledged = false;
+    unsigned m_excluded_run = 0;    // Consecutive samples kept out of the baselines
+    double m_last_discharge = 0;
+    int m_last_hour = 0;
+};
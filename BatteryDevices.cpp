@@ -0,0 +1,425 @@
+#include "pch.h"
+#include "BatteryDevices.h"
+
+#include <SetupAPI.h>
+#include <devguid.h>
+#include <winioctl.h>
+
+#pragma comment(lib, "setupapi.lib")
+
+// If GUID_DEVCLASS_BATTERY is still undefined, define it manually
+#ifndef GUID_DEVCLASS_BATTERY
+DEFINE_GUID(GUID_DEVCLASS_BATTERY, 0x72631E54L, 0x78A4, 0x11D0, 0xBC, 0xF7, 0x00, 0xAA, 0x00, 0xB7, 0xB3, 0x2A);
+#endif
+
+// If battery IOCTLs are undefined, define them manually
+#ifndef IOCTL_BATTERY_QUERY_TAG
+#define BATTERY_IOCTL_INDEX 0x0800
+#define IOCTL_BATTERY_QUERY_TAG \
+    CTL_CODE(FILE_DEVICE_BATTERY, BATTERY_IOCTL_INDEX + 0, METHOD_BUFFERED, FILE_READ_ACCESS)
+#define IOCTL_BATTERY_QUERY_STATUS \
+    CTL_CODE(FILE_DEVICE_BATTERY, BATTERY_IOCTL_INDEX + 3, METHOD_BUFFERED, FILE_READ_ACCESS)
+#endif
+
+#ifndef FILE_DEVICE_BATTERY
+#define FILE_DEVICE_BATTERY 0x00000029
+#endif
+
+namespace
+{
+    // Opens one battery and reads its tag. For overlapped handles the tag query runs before
+    // the handle is bound to the completion port, so it is waited for with an event.
+    HANDLE OpenBattery(const wchar_t* devicePath, bool overlappedIo, ULONG& tag)
+    {
+        DWORD flags = FILE_ATTRIBUTE_NORMAL | (overlappedIo ? FILE_FLAG_OVERLAPPED : 0);
+        HANDLE hBattery = CreateFile(devicePath, GENERIC_READ | GENERIC_WRITE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, flags, NULL);
+        if (hBattery == INVALID_HANDLE_VALUE)
+            return INVALID_HANDLE_VALUE;
+
+        DWORD dwWait = 0;
+        DWORD dwOut = 0;
+        BOOL ok = FALSE;
+        tag = 0;
+        if (overlappedIo)
+        {
+            OVERLAPPED overlapped = { 0 };
+            overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+            if (!overlapped.hEvent)
+            {
+                CloseHandle(hBattery);
+                return INVALID_HANDLE_VALUE;
+            }
+
+            ok = DeviceIoControl(hBattery, IOCTL_BATTERY_QUERY_TAG, &dwWait, sizeof(dwWait), &tag, sizeof(tag), NULL, &overlapped);
+            if (!ok && GetLastError() == ERROR_IO_PENDING)
+                ok = GetOverlappedResult(hBattery, &overlapped, &dwOut, TRUE);
+            CloseHandle(overlapped.hEvent);
+        }
+        else
+        {
+            ok = DeviceIoControl(hBattery, IOCTL_BATTERY_QUERY_TAG, &dwWait, sizeof(dwWait), &tag, sizeof(tag), &dwOut, NULL);
+        }
+
+        if (!ok || tag == 0)
+        {
+            CloseHandle(hBattery);
+            return INVALID_HANDLE_VALUE;
+        }
+        return hBattery;
+    }
+}
+
+CBatteryDevices::CBatteryDevices()
+{
+}
+
+CBatteryDevices::~CBatteryDevices()
+{
+    Close();
+#ifdef BATTERY_FAKE_DEVICES
+    if (m_fake_cancel)
+        CloseHandle(m_fake_cancel);
+#endif
+}
+
+bool CBatteryDevices::Open()
+{
+    if (m_needs_refresh)
+        Close();
+    if (IsOpen())
+        return true;
+
+#ifdef BATTERY_FAKE_DEVICES
+    if (!m_fake_delays.empty())
+        return OpenFakeBatteries();
+#endif
+
+    // Without a working completion port the batteries are queried one after another
+    if (OpenBatteries(true))
+        return true;
+    return OpenBatteries(false);
+}
+
+bool CBatteryDevices::OpenBatteries(bool overlapped)
+{
+    HDEVINFO hdev = SetupDiGetClassDevs(&GUID_DEVCLASS_BATTERY, 0, 0, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+    if (hdev == INVALID_HANDLE_VALUE)
+        return false;
+
+    SP_DEVICE_INTERFACE_DATA did = { 0 };
+    did.cbSize = sizeof(did);
+
+    for (DWORD index = 0; SetupDiEnumDeviceInterfaces(hdev, 0, &GUID_DEVCLASS_BATTERY, index, &did); ++index)
+    {
+        DWORD cbRequired = 0;
+        SetupDiGetDeviceInterfaceDetail(hdev, &did, 0, 0, &cbRequired, 0);
+        if (cbRequired == 0)
+            continue;
+
+        PSP_DEVICE_INTERFACE_DETAIL_DATA pdidd = (PSP_DEVICE_INTERFACE_DETAIL_DATA)LocalAlloc(LPTR, cbRequired);
+        if (!pdidd)
+            continue;
+
+        pdidd->cbSize = sizeof(*pdidd);
+        if (!SetupDiGetDeviceInterfaceDetail(hdev, &did, pdidd, cbRequired, &cbRequired, 0))
+        {
+            LocalFree(pdidd);
+            continue;
+        }
+
+        Battery battery;
+        battery.hBattery = OpenBattery(pdidd->DevicePath, overlapped, battery.tag);
+        LocalFree(pdidd);
+
+        if (battery.hBattery != INVALID_HANDLE_VALUE)
+            m_batteries.push_back(battery);
+    }
+    SetupDiDestroyDeviceInfoList(hdev);
+
+    if (m_batteries.empty())
+        return false;
+    if (!overlapped)
+        return true;
+
+    m_completion_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    bool bound = m_completion_port != NULL;
+
+    // Requests that finish synchronously are handled inline and must not also queue a packet,
+    // otherwise their request would be recycled twice
+    for (size_t i = 0; bound && i < m_batteries.size(); i++)
+    {
+        bound = CreateIoCompletionPort(m_batteries[i].hBattery, m_completion_port, i, 0) == m_completion_port
+            && SetFileCompletionNotificationModes(m_batteries[i].hBattery, FILE_SKIP_COMPLETION_PORT_ON_SUCCESS);
+    }
+
+    if (!bound)
+    {
+        // No request has been issued yet, so the handles can be closed right away
+        CloseBatteries();
+        return false;
+    }
+
+    m_entries.resize(m_batteries.size());
+    m_needs_refresh = false;
+    return true;
+}
+
+void CBatteryDevices::Close()
+{
+    CancelPending();
+    CloseBatteries();
+    m_results.clear();
+
+    // A request the driver never gave back may still be written to; leave it allocated
+    if (m_outstanding > 0)
+    {
+        for (std::unique_ptr<Request>& request : m_requests)
+            request.release();
+        m_outstanding = 0;
+    }
+    m_requests.clear();
+    m_free_requests.clear();
+}
+
+void CBatteryDevices::CloseBatteries()
+{
+    for (Battery& battery : m_batteries)
+    {
+        if (battery.hBattery != INVALID_HANDLE_VALUE)
+            CloseHandle(battery.hBattery);
+    }
+    m_batteries.clear();
+
+    if (m_completion_port)
+    {
+        CloseHandle(m_completion_port);
+        m_completion_port = NULL;
+    }
+    m_needs_refresh = false;
+}
+
+CBatteryDevices::Request* CBatteryDevices::AcquireRequest()
+{
+    if (m_free_requests.empty())
+    {
+        m_requests.push_back(std::make_unique<Request>());
+        return m_requests.back().get();
+    }
+
+    Request* request = m_free_requests.back();
+    m_free_requests.pop_back();
+    return request;
+}
+
+void CBatteryDevices::ReleaseRequest(Request* request)
+{
+    m_free_requests.push_back(request);
+}
+
+const std::vector<CBatteryDevices::BatteryStatus>& CBatteryDevices::QueryStatus(DWORD timeoutMs)
+{
+    m_results.clear();
+    if (!IsOpen())
+        return m_results;
+
+    if (!m_completion_port)
+    {
+        QueryStatusSynchronous();
+        return m_results;
+    }
+
+    // Issue every request before waiting for any of them
+    ++m_batch;
+    for (size_t i = 0; i < m_batteries.size(); i++)
+    {
+        Request* request = AcquireRequest();
+        request->overlapped = OVERLAPPED();
+        request->waitStatus = BATTERY_WAIT_STATUS();
+        request->waitStatus.BatteryTag = m_batteries[i].tag;
+        request->battery = i;
+        request->batch = m_batch;
+
+        if (IssueQuery(m_batteries[i], request))
+        {
+            m_results.push_back({ i, request->status });
+            ReleaseRequest(request);
+        }
+        else if (GetLastError() == ERROR_IO_PENDING)
+        {
+            ++m_outstanding;
+        }
+        else
+        {
+            // ERROR_FILE_NOT_FOUND here means the tag is stale, e.g. the battery was swapped
+            m_needs_refresh = true;
+            ReleaseRequest(request);
+        }
+    }
+
+    // Gather the answers; normally one wait returns all of them
+    ULONGLONG deadline = GetTickCount64() + timeoutMs;
+    while (m_outstanding > 0)
+    {
+        ULONGLONG now = GetTickCount64();
+        if (now >= deadline)
+            break;
+
+        ULONG removed = 0;
+        if (!GetQueuedCompletionStatusEx(m_completion_port, m_entries.data(), static_cast<ULONG>(m_entries.size()),
+            &removed, static_cast<DWORD>(deadline - now), FALSE))
+            break;
+
+        for (ULONG i = 0; i < removed; i++)
+            CompleteRequest(m_entries[i]);
+    }
+
+    // A battery that did not answer in time must not keep writing into its buffers
+    CancelPending();
+    return m_results;
+}
+
+BOOL CBatteryDevices::IssueQuery(const Battery& battery, Request* request)
+{
+#ifdef BATTERY_FAKE_DEVICES
+    if (!m_fake_delays.empty())
+    {
+        // Only a submitted query queues a packet. Set the error either way, a stale
+        // ERROR_IO_PENDING would make CancelPending() wait for a packet that never comes.
+        request->owner = this;
+        SetLastError(TrySubmitThreadpoolCallback(FakeQueryCallback, request, NULL) ? ERROR_IO_PENDING : ERROR_NOT_ENOUGH_MEMORY);
+        return FALSE;
+    }
+#endif
+    return DeviceIoControl(battery.hBattery, IOCTL_BATTERY_QUERY_STATUS, &request->waitStatus, sizeof(request->waitStatus),
+        &request->status, sizeof(request->status), NULL, &request->overlapped);
+}
+
+void CBatteryDevices::QueryStatusSynchronous()
+{
+    for (size_t i = 0; i < m_batteries.size(); i++)
+    {
+        BATTERY_WAIT_STATUS waitStatus = { 0 };
+        BATTERY_STATUS status = { 0 };
+        DWORD dwOut = 0;
+        waitStatus.BatteryTag = m_batteries[i].tag;
+
+        if (DeviceIoControl(m_batteries[i].hBattery, IOCTL_BATTERY_QUERY_STATUS, &waitStatus, sizeof(waitStatus),
+            &status, sizeof(status), &dwOut, NULL))
+            m_results.push_back({ i, status });
+        else
+            m_needs_refresh = true;
+    }
+}
+
+void CBatteryDevices::CompleteRequest(const OVERLAPPED_ENTRY& entry)
+{
+    if (!entry.lpOverlapped)
+        return;
+
+    Request* request = CONTAINING_RECORD(entry.lpOverlapped, Request, overlapped);
+    --m_outstanding;
+
+    // A cancelled request of an earlier batch only gives its buffers back
+    if (request->batch == m_batch)
+    {
+        DWORD dwOut = 0;
+        if (GetOverlappedResult(m_batteries[request->battery].hBattery, &request->overlapped, &dwOut, FALSE))
+            m_results.push_back({ request->battery, request->status });
+        else if (GetLastError() != ERROR_OPERATION_ABORTED)
+            m_needs_refresh = true;
+    }
+    ReleaseRequest(request);
+}
+
+void CBatteryDevices::CancelPending()
+{
+    if (m_outstanding == 0 || !m_completion_port)
+        return;
+
+    // Whatever still arrives belongs to the cancelled batch
+    ++m_batch;
+    for (Battery& battery : m_batteries)
+        CancelIoEx(battery.hBattery, NULL);
+#ifdef BATTERY_FAKE_DEVICES
+    if (m_fake_cancel)
+        SetEvent(m_fake_cancel);
+#endif
+
+    // Every cancelled request still queues exactly one packet; its buffers are only free
+    // once that packet has been dequeued
+    while (m_outstanding > 0)
+    {
+        ULONG removed = 0;
+        if (!GetQueuedCompletionStatusEx(m_completion_port, m_entries.data(), static_cast<ULONG>(m_entries.size()),
+            &removed, INFINITE, FALSE))
+            break;
+
+        for (ULONG i = 0; i < removed; i++)
+            CompleteRequest(m_entries[i]);
+    }
+#ifdef BATTERY_FAKE_DEVICES
+    if (m_fake_cancel)
+        ResetEvent(m_fake_cancel);
+#endif
+}
+
+#ifdef BATTERY_FAKE_DEVICES
+void CBatteryDevices::UseFakeDevices(const std::vector<DWORD>& delaysMs)
+{
+    Close();
+    m_fake_delays = delaysMs;
+}
+
+bool CBatteryDevices::OpenFakeBatteries()
+{
+    if (!m_fake_cancel)
+        m_fake_cancel = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_completion_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+    if (!m_fake_cancel || !m_completion_port)
+    {
+        CloseBatteries();
+        return false;
+    }
+
+    // Simulated batteries have no handle; their queries complete through the same port
+    for (size_t i = 0; i < m_fake_delays.size(); i++)
+    {
+        Battery battery;
+        battery.tag = static_cast<ULONG>(i + 1);
+        m_batteries.push_back(battery);
+    }
+    m_entries.resize(m_batteries.size());
+    m_needs_refresh = false;
+    return true;
+}
+
+void CALLBACK CBatteryDevices::FakeQueryCallback(PTP_CALLBACK_INSTANCE instance, PVOID context)
+{
+    CallbackMayRunLong(instance);
+
+    // Complete the request the way the driver would. GetOverlappedResult() only reads the
+    // status and byte count from the OVERLAPPED once the request is no longer pending.
+    const NTSTATUS STATUS_CANCELLED_FAKE = static_cast<NTSTATUS>(0xC0000120L);
+    Request* request = static_cast<Request*>(context);
+    CBatteryDevices* owner = request->owner;
+    if (WaitForSingleObject(owner->m_fake_cancel, owner->m_fake_delays[request->battery]) == WAIT_OBJECT_0)
+    {
+        request->overlapped.Internal = static_cast<ULONG_PTR>(STATUS_CANCELLED_FAKE);
+        request->overlapped.InternalHigh = 0;
+    }
+    else
+    {
+        // Battery n discharges at n watts
+        request->status = BATTERY_STATUS();
+        request->status.PowerState = BATTERY_DISCHARGING;
+        request->status.Capacity = 40000;
+        request->status.Voltage = 11400;
+        request->status.Rate = -1000 * static_cast<LONG>(request->battery + 1);
+        request->overlapped.Internal = 0;
+        request->overlapped.InternalHigh = sizeof(request->status);
+    }
+    PostQueuedCompletionStatus(owner->m_completion_port, static_cast<DWORD>(request->overlapped.InternalHigh),
+        request->battery, &request->overlapped);
+}
+#endif
@@ -0,0 +1,96 @@
+#pragma once
+#include <Windows.h>
+#include <Batclass.h>
+#include <memory>
+#include <vector>
+
+// Keeps overlapped handles to all batteries open between ticks and queries their
+// status as one batch, so a tick waits for the slowest battery instead of the sum of all.
+// Falls back to querying the batteries one after another when the completion port
+// cannot be set up.
+class CBatteryDevices
+{
+public:
+    CBatteryDevices();
+    ~CBatteryDevices();
+
+    CBatteryDevices(const CBatteryDevices&) = delete;
+    CBatteryDevices& operator=(const CBatteryDevices&) = delete;
+
+    // Enumerates the batteries and opens them if that has not happened yet
+    bool Open();
+    void Close();
+    bool IsOpen() const { return !m_batteries.empty(); }
+    size_t GetBatteryCount() const { return m_batteries.size(); }
+
+    // Answer of one battery. The index stays the same until the batteries are opened again.
+    struct BatteryStatus
+    {
+        size_t battery;
+        BATTERY_STATUS status;
+    };
+
+    // Sends IOCTL_BATTERY_QUERY_STATUS to every battery at once and collects the answers with a
+    // single wait. Returns the statuses of the batteries that answered within timeoutMs.
+    const std::vector<BatteryStatus>& QueryStatus(DWORD timeoutMs);
+
+#ifdef BATTERY_FAKE_DEVICES
+    // Test backend: the next Open() creates one simulated battery per entry instead of opening
+    // the real ones. Each answers a status query after its delay, or when the query is cancelled.
+    void UseFakeDevices(const std::vector<DWORD>& delaysMs);
+#endif
+
+private:
+    struct Battery
+    {
+        HANDLE hBattery = INVALID_HANDLE_VALUE;
+        ULONG tag = 0;
+    };
+
+    // One status query. The kernel owns it from DeviceIoControl() until its completion packet
+    // has been dequeued, so every query has its own buffers and remembers the batch it
+    // belongs to; a late packet of an earlier batch is recognized and only recycled.
+    struct Request
+    {
+        OVERLAPPED overlapped = {};
+        BATTERY_WAIT_STATUS waitStatus = {};
+        BATTERY_STATUS status = {};
+        size_t battery = 0;
+        ULONG batch = 0;
+#ifdef BATTERY_FAKE_DEVICES
+        CBatteryDevices* owner = nullptr;
+#endif
+    };
+
+    bool OpenBatteries(bool overlapped);
+    void CloseBatteries();
+    BOOL IssueQuery(const Battery& battery, Request* request);
+    void QueryStatusSynchronous();
+    Request* AcquireRequest();
+    void ReleaseRequest(Request* request);
+
+    // Recycles the request of a dequeued packet and adds its status to the results when it
+    // belongs to the current batch
+    void CompleteRequest(const OVERLAPPED_ENTRY& entry);
+
+    // Cancels every outstanding request and waits until all their packets have been dequeued
+    void CancelPending();
+
+    std::vector<Battery> m_batteries;
+    std::vector<BatteryStatus> m_results;
+    std::vector<OVERLAPPED_ENTRY> m_entries;
+    std::vector<std::unique_ptr<Request>> m_requests;   // Every request ever allocated
+    std::vector<Request*> m_free_requests;
+    size_t m_outstanding = 0;                           // Requests whose packet is still due
+    ULONG m_batch = 0;
+    HANDLE m_completion_port = NULL;                    // NULL in the synchronous fallback
+    bool m_needs_refresh = false;                       // A battery was removed or its tag changed
+
+#ifdef BATTERY_FAKE_DEVICES
+    bool OpenFakeBatteries();
+    static void CALLBACK FakeQueryCallback(PTP_CALLBACK_INSTANCE instance, PVOID context);
+
+    std::vector<DWORD> m_fake_delays;
+    HANDLE m_fake_cancel = NULL;                        // Manual-reset, set while CancelPending() runs
+#endif
+};
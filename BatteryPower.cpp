@@ -19,9 +19,52 @@ const wchar_t* CBatteryPowerPlugin::GetItemLableText() const {
 }
 
 const wchar_t* CBatteryPowerPlugin::GetItemValueText() const {
-    return CDataManager::Instance().m_cur_b_rate.c_str();
+    // A copy, the sampling thread may replace the text while TrafficMonitor uses this one
+    m_value_text = CDataManager::Instance().GetValueText();
+    return m_value_text.c_str();
 }
 
 const wchar_t* CBatteryPowerPlugin::GetItemValueSampleText() const {
     return L"12.5 W";
 }
+
+bool CBatteryPowerPlugin::IsCustomDraw() const {
+    return CDataManager::Instance().m_drain_alert;
+}
+
+int CBatteryPowerPlugin::GetItemWidthEx(void* hDC) const {
+    AFX_MANAGE_STATE(AfxGetStaticModuleState());
+    CDC* pDC = CDC::FromHandle((HDC)hDC);
+
+    // Size for the sample text so the item does not change width with every value
+    CString label = GetItemLableText();
+    CString value = GetItemValueSampleText();
+    CString current = GetItemValueText();
+    if (current.GetLength() > value.GetLength())
+        value = current;
+    return pDC->GetTextExtent(label + L" " + value).cx;
+}
+
+void CBatteryPowerPlugin::DrawItem(void* hDC, int x, int y, int w, int h, bool dark_mode) {
+    AFX_MANAGE_STATE(AfxGetStaticModuleState());
+    CDC* pDC = CDC::FromHandle((HDC)hDC);
+    const CDataManager& data = CDataManager::Instance();
+
+    // Colors configured in TrafficMonitor, or plain black/white until they are known
+    COLORREF defaultColor = dark_mode ? RGB(255, 255, 255) : RGB(0, 0, 0);
+    COLORREF labelColor = data.m_has_label_color ? data.m_label_color : defaultColor;
+    COLORREF valueColor = data.m_has_value_color ? data.m_value_color : defaultColor;
+    if (data.m_drain_alert)
+        valueColor = dark_mode ? RGB(255, 96, 96) : RGB(208, 0, 0);
+
+    CRect rect(CPoint(x, y), CSize(w, h));
+    CString label = GetItemLableText();
+    label += L" ";
+    pDC->SetBkMode(TRANSPARENT);
+    pDC->SetTextColor(labelColor);
+    pDC->DrawText(label, rect, DT_LEFT | DT_VCENTER | DT_SINGLELINE | DT_NOPREFIX);
+
+    rect.left += pDC->GetTextExtent(label).cx;
+    pDC->SetTextColor(valueColor);
+    pDC->DrawText(GetItemValueText(), rect, DT_LEFT | DT_VCENTER | DT_SINGLELINE | DT_NOPREFIX);
+}
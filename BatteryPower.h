@@ -1,6 +1,7 @@
 #pragma once
 
 #include "PluginInterface.h"
+#include <string>
 
 class CBatteryPowerPlugin : public IPluginItem {
 public:
@@ -12,5 +13,15 @@ public:
     const wchar_t* GetItemLableText() const override;
     const wchar_t* GetItemValueText() const override;
     const wchar_t* GetItemValueSampleText() const override;
+
+    // Drawn by the plugin only while abnormal drain is flagged, so the value can turn red.
+    // Otherwise TrafficMonitor renders the label and value with its own settings. While the
+    // plugin draws, TrafficMonitor ignores a customized label text; see README.md.
+    bool IsCustomDraw() const override;
+    int GetItemWidthEx(void* hDC) const override;
+    void DrawItem(void* hDC, int x, int y, int w, int h, bool dark_mode) override;
+
+private:
+    mutable std::wstring m_value_text;  // Copy returned by GetItemValueText()
 };
 
@@ -3,32 +3,25 @@
 #include "DataManager.h"
 
 #include <Windows.h>
-#include <SetupAPI.h>
 #include <Batclass.h>
-#include <devguid.h>
-#include <winioctl.h>
 #include <string>
+#include <vector>
 #include <iostream>
+#include <cmath>
 
-#pragma comment(lib, "setupapi.lib")
+// CPU time baseline of GetEstimatedSystemPowerUsage()
+static FILETIME lastIdleTime = { 0 }, lastKernelTime = { 0 }, lastUserTime = { 0 };
+static bool firstCall = true;
 
-// If GUID_DEVCLASS_BATTERY is still undefined, define it manually
-#ifndef GUID_DEVCLASS_BATTERY
-DEFINE_GUID(GUID_DEVCLASS_BATTERY, 0x72631E54L, 0x78A4, 0x11D0, 0xBC, 0xF7, 0x00, 0xAA, 0x00, 0xB7, 0xB3, 0x2A);
-#endif
+// How often the drain baselines are written to the configuration file
+static const unsigned long long BASELINE_SAVE_INTERVAL_MS = 10 * 60 * 1000;
 
-// If battery IOCTLs are undefined, define them manually
-#ifndef IOCTL_BATTERY_QUERY_TAG
-#define BATTERY_IOCTL_INDEX 0x0800
-#define IOCTL_BATTERY_QUERY_TAG \
-    CTL_CODE(FILE_DEVICE_BATTERY, BATTERY_IOCTL_INDEX + 0, METHOD_BUFFERED, FILE_READ_ACCESS)
-#define IOCTL_BATTERY_QUERY_STATUS \
-    CTL_CODE(FILE_DEVICE_BATTERY, BATTERY_IOCTL_INDEX + 3, METHOD_BUFFERED, FILE_READ_ACCESS)
-#endif
-
-#ifndef FILE_DEVICE_BATTERY
-#define FILE_DEVICE_BATTERY 0x00000029
-#endif
+// Forgets the CPU time baseline, e.g. after resume, so the next estimate does not
+// average the CPU usage over the time the system was asleep
+void ResetEstimatedSystemPowerUsage()
+{
+    firstCall = true;
+}
 
 // Helper function to estimate power usage based on system metrics
 double GetEstimatedSystemPowerUsage()
@@ -48,8 +41,6 @@ double GetEstimatedSystemPowerUsage()
     double basePower = 10.0; // Base power in watts
 
     // Calculate CPU usage percentage
-    static FILETIME lastIdleTime = { 0 }, lastKernelTime = { 0 }, lastUserTime = { 0 };
-    static bool firstCall = true;
     double cpuUsage = 0.0;
 
     if (!firstCall)
@@ -103,22 +94,30 @@ double EstimateCurrentPowerDraw()
     return 15.0; // Default 15W for ThinkPad in idle state
 }
 
-std::wstring GetBatteryPowerRate()
+// Formats a power value with two decimals followed by the unit and an optional direction sign
+std::wstring FormatPower(PowerWatts power, const wchar_t* suffix)
+{
+    wchar_t number[24];
+    power.Format(number, _countof(number), 2);
+    wchar_t buffer[32];
+    swprintf_s(buffer, L"%s %s", number, suffix);
+    return buffer;
+}
+
+std::wstring GetBatteryPowerRate(CBatteryDevices& batteries, CDataManager& data)
 {
     std::wstring result = L"0.00 W";
-    HDEVINFO hdev = SetupDiGetClassDevs(&GUID_DEVCLASS_BATTERY, 0, 0, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
-    if (hdev == INVALID_HANDLE_VALUE)
+    data.m_cur_battery_rate = PowerWatts();
+    data.m_cur_system_power = PowerWatts();
+    data.m_system_power_measured = false;
+    if (!batteries.Open())
         return result;
 
-    SP_DEVICE_INTERFACE_DATA did = { 0 };
-    did.cbSize = sizeof(did);
-
-    // Use double for higher precision
-    double totalRateMilliwatts = 0.0;
+    PowerWatts totalRate;
     bool foundBattery = false;
     bool isOnAC = false;
     bool isBatteryCharging = false;
-    double currentSystemLoad = 0.0;
+    PowerWatts currentSystemLoad;
 
     // Get system power status first
     SYSTEM_POWER_STATUS powerStatus;
@@ -128,108 +127,69 @@ std::wstring GetBatteryPowerRate()
         isOnAC = (powerStatus.ACLineStatus == 1);
     }
 
-    // Enumerate all batteries in the system
-    for (DWORD index = 0; SetupDiEnumDeviceInterfaces(hdev, 0, &GUID_DEVCLASS_BATTERY, index, &did); ++index)
-    {
-        DWORD cbRequired = 0;
-        SetupDiGetDeviceInterfaceDetail(hdev, &did, 0, 0, &cbRequired, 0);
-        if (cbRequired == 0)
-            continue;
+    // Get an accurate reading by averaging multiple samples. Each sample queries all
+    // batteries at once. Every battery is averaged over the samples it answered, so one
+    // that misses a sample does not pull the total down.
+    const int NUM_SAMPLES = 3;
+    const DWORD QUERY_TIMEOUT_MS = 500;
+    std::vector<PowerWatts> rateSums(batteries.GetBatteryCount());
+    std::vector<int> validSamples(batteries.GetBatteryCount());
 
-        PSP_DEVICE_INTERFACE_DETAIL_DATA pdidd = (PSP_DEVICE_INTERFACE_DETAIL_DATA)LocalAlloc(LPTR, cbRequired);
-        if (!pdidd)
-            continue;
-
-        pdidd->cbSize = sizeof(*pdidd);
-        if (!SetupDiGetDeviceInterfaceDetail(hdev, &did, pdidd, cbRequired, &cbRequired, 0))
-        {
-            LocalFree(pdidd);
-            continue;
-        }
-
-        // Open a handle to the battery
-        HANDLE hBattery = CreateFile(pdidd->DevicePath, GENERIC_READ | GENERIC_WRITE,
-            FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-        LocalFree(pdidd);
+    for (int sample = 0; sample < NUM_SAMPLES; sample++)
+    {
+        // Small delay between samples
+        if (sample > 0)
+            Sleep(50);
 
-        if (hBattery == INVALID_HANDLE_VALUE)
+        const std::vector<CBatteryDevices::BatteryStatus>& statuses = batteries.QueryStatus(QUERY_TIMEOUT_MS);
+        if (statuses.empty())
             continue;
 
-        // Get battery information
-        BATTERY_QUERY_INFORMATION bqi = { 0 };
-        DWORD dwWait = 0;
-        DWORD dwOut;
-
-        // First, get the battery tag
-        if (DeviceIoControl(hBattery, IOCTL_BATTERY_QUERY_TAG, &dwWait, sizeof(dwWait), &bqi.BatteryTag, sizeof(bqi.BatteryTag), &dwOut, NULL)
-            && bqi.BatteryTag)
+        for (const CBatteryDevices::BatteryStatus& answer : statuses)
         {
-            // Now get the battery status - try multiple times to ensure accuracy
-            BATTERY_WAIT_STATUS bws = { 0 };
-            bws.BatteryTag = bqi.BatteryTag;
+            const BATTERY_STATUS& bs = answer.status;
 
-            BATTERY_STATUS bs = { 0 };
+            // Rate is reported in milliwatts
+            rateSums[answer.battery] += PowerWatts::FromUnits(bs.Rate, 1000);
+            validSamples[answer.battery]++;
 
-            // Get an accurate reading by averaging multiple samples
-            const int NUM_SAMPLES = 3;
-            int validSamples = 0;
-            double batteryRateSum = 0.0;
-
-            for (int sample = 0; sample < NUM_SAMPLES; sample++)
+            // Record system load when battery is neither charging nor discharging
+            if (bs.PowerState & BATTERY_POWER_ON_LINE)  // System is on AC power
             {
-                if (DeviceIoControl(hBattery, IOCTL_BATTERY_QUERY_STATUS, &bws, sizeof(bws), &bs, sizeof(bs), &dwOut, NULL))
+                // Use the current draw as an estimate of system power usage
+                // when not charging (Rate near 0) or when fully charged
+                if (abs(bs.Rate) < 50)  // Near zero rate threshold (milliwatts)
                 {
-                    batteryRateSum += bs.Rate;
-                    validSamples++;
-                    foundBattery = true;
-
-                    // Record system load when battery is neither charging nor discharging
-                    if (bs.PowerState & BATTERY_POWER_ON_LINE)  // System is on AC power
-                    {
-                        // Use the current draw as an estimate of system power usage
-                        // when not charging (Rate near 0) or when fully charged
-                        if (abs(bs.Rate) < 50)  // Near zero rate threshold (milliwatts)
-                        {
-                            currentSystemLoad = GetEstimatedSystemPowerUsage();
-                        }
-                        else if (bs.Rate > 0)  // Positive rate means charging
-                        {
-                            isBatteryCharging = true;
-                        }
-                    }
+                    currentSystemLoad = PowerWatts::FromDouble(GetEstimatedSystemPowerUsage());
+                }
+                else if (bs.Rate > 0)  // Positive rate means charging
+                {
+                    isBatteryCharging = true;
                 }
-
-                // Small delay between samples
-                Sleep(50);
-            }
-
-            // Average the readings if we got more than one
-            if (validSamples > 1)
-            {
-                totalRateMilliwatts = batteryRateSum / validSamples;
-            }
-            else if (validSamples == 1)
-            {
-                totalRateMilliwatts = batteryRateSum;
             }
         }
-        CloseHandle(hBattery);
+        foundBattery = true;
+    }
+
+    // Average the readings of each battery, then add the batteries up
+    for (size_t i = 0; i < rateSums.size(); i++)
+    {
+        if (validSamples[i] > 0)
+            totalRate += rateSums[i] / validSamples[i];
     }
-    SetupDiDestroyDeviceInfoList(hdev);
 
     if (foundBattery)
     {
-        // Convert milliwatts to watts with high precision
-        double watts = totalRateMilliwatts / 1000.0;
-        wchar_t buffer[32];
+        const PowerWatts NEAR_ZERO_RATE = PowerWatts::FromUnits(50, 1000);
+        data.m_cur_battery_rate = totalRate;
 
         // Case 1: On AC power but battery not charging (rate near zero)
-        if (isOnAC && !isBatteryCharging && abs(watts) < 0.05)
+        if (isOnAC && !isBatteryCharging && totalRate.Abs() < NEAR_ZERO_RATE)
         {
             // If we have a direct measurement of system load, use it
-            if (currentSystemLoad > 0)
+            if (currentSystemLoad > PowerWatts())
             {
-                swprintf_s(buffer, L"%.2f W", currentSystemLoad);
+                data.m_cur_system_power = currentSystemLoad;
             }
             // Otherwise estimate based on battery capacity and discharge rate
             else
@@ -237,22 +197,21 @@ std::wstring GetBatteryPowerRate()
                 // Get an estimate of system power usage when on AC but battery not charging
                 // This is based on typical power states for the system
                 // For ThinkPad, this is typically around 15-45W depending on CPU/GPU load
-                double estimatedUsage = EstimateCurrentPowerDraw();
-                swprintf_s(buffer, L"%.2f W", estimatedUsage);
+                data.m_cur_system_power = PowerWatts::FromDouble(EstimateCurrentPowerDraw());
             }
-            result = buffer;
+            result = FormatPower(data.m_cur_system_power, L"W");
         }
         // Case 2: Normal battery charging/discharging
         else
         {
             // Use different format based on charging or discharging
-            if (watts > 0) {
-                swprintf_s(buffer, L"%.2f W+", watts); // Charging (positive)
-                result = buffer;
+            if (totalRate > PowerWatts()) {
+                result = FormatPower(totalRate, L"W+"); // Charging (positive)
             }
-            else if (watts < 0) {
-                swprintf_s(buffer, L"%.2f W-", -watts); // Discharging (negative)
-                result = buffer;
+            else if (totalRate < PowerWatts()) {
+                result = FormatPower(-totalRate, L"W-"); // Discharging (negative)
+                data.m_cur_system_power = -totalRate;  // The battery feeds the whole system
+                data.m_system_power_measured = true;
             }
             else {
                 result = L"0.00 W"; // No power flow
@@ -263,7 +222,6 @@ std::wstring GetBatteryPowerRate()
     return result;
 }
 
-
 CBatteryPowerRatePlugin CBatteryPowerRatePlugin::m_instance;
 
 CBatteryPowerRatePlugin::CBatteryPowerRatePlugin()
@@ -290,7 +248,132 @@ IPluginItem* CBatteryPowerRatePlugin::GetItem(int index)
 
 void CBatteryPowerRatePlugin::DataRequired()
 {
-    CDataManager::Instance().m_cur_b_rate = GetBatteryPowerRate().c_str();
+    // The first sample enumerates the batteries and sleeps between readings. It runs on the
+    // thread pool so loading the plugin does not hold up TrafficMonitor's startup; until it
+    // finishes the last persisted value (or a placeholder) is shown.
+    if (!m_first_sample_done)
+    {
+        if (!m_first_sample_started)
+        {
+            m_first_sample_started = true;
+
+            // The callback holds a reference to this DLL, so TrafficMonitor unloading the plugin
+            // meanwhile only takes effect once the callback has returned
+            HMODULE module = NULL;
+            if (GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, reinterpret_cast<LPCWSTR>(&FirstSampleCallback), &module))
+            {
+                m_callback_module = module;
+                if (!TrySubmitThreadpoolCallback(FirstSampleCallback, this, NULL))
+                {
+                    m_callback_module = NULL;
+                    FreeLibrary(module);
+                    module = NULL;
+                }
+            }
+            if (!module)
+                FirstSampleCallback(NULL, this);
+        }
+        return;
+    }
+    UpdateData();
+}
+
+void CALLBACK CBatteryPowerRatePlugin::FirstSampleCallback(PTP_CALLBACK_INSTANCE instance, PVOID context)
+{
+    CBatteryPowerRatePlugin* plugin = static_cast<CBatteryPowerRatePlugin*>(context);
+    if (instance)
+    {
+        CallbackMayRunLong(instance);
+        FreeLibraryWhenCallbackReturns(instance, plugin->m_callback_module);
+    }
+
+    plugin->UpdateData();
+    plugin->m_first_sample_done = true;
+}
+
+void CBatteryPowerRatePlugin::UpdateData()
+{
+    CDataManager& data = CDataManager::Instance();
+    data.m_cur_sample = m_timeline.Advance();
+
+    // The drain baselines take hours to learn, keep them across sessions. The configuration
+    // directory may arrive on the UI thread while this sample runs, so work with one copy of
+    // the path and only ever save the baselines into the file they were loaded from.
+    const std::wstring configPath = data.GetConfigPath();
+    if (configPath != m_baselines_path)
+    {
+        m_drain_detector.Load(configPath.c_str());
+        m_baselines_path = configPath;
+    }
+
+    // After a suspend or a long stall the previous baselines describe a different period.
+    // Start new intervals instead of spreading the gap over this sample.
+    bool continuous = (data.m_cur_sample.event == CSampleTimeline::SE_NONE);
+    if (!continuous)
+    {
+        ResetEstimatedSystemPowerUsage();
+        m_process_power.Rebase();
+        m_drain_detector.ResetChangePoint();
+    }
+
+    data.SetValueText(GetBatteryPowerRate(m_batteries, data));
+    data.AccumulateEnergy(continuous ? data.m_cur_sample.intervalMs : 0);
+
+    SYSTEMTIME localTime;
+    GetLocalTime(&localTime);
+    if (m_acknowledge_alert.exchange(false))
+        m_drain_detector.Acknowledge();
+    PublishDrainState(m_drain_detector.Update(-data.m_cur_battery_rate.ToDouble(), localTime.wHour));
+    if (!m_baselines_path.empty() && data.m_cur_sample.timeMs - m_baselines_saved_ms >= BASELINE_SAVE_INTERVAL_MS)
+    {
+        m_drain_detector.Save(m_baselines_path.c_str());
+        m_baselines_saved_ms = data.m_cur_sample.timeMs;
+    }
+    data.SaveLastValue(data.m_cur_sample.timeMs);
+    PublishSample();
+    // On AC the system power is an estimate, splitting it into per-process watts would invent numbers
+    m_process_power.Update(data.m_system_power_measured ? data.m_cur_system_power.ToDouble() : 0.0);
+}
+
+void CBatteryPowerRatePlugin::PublishDrainState(bool alerting)
+{
+    const CAnomalyDetector::Baseline& baseline = m_drain_detector.GetBaseline(m_drain_detector.GetLastHour());
+    DrainState state;
+    state.discharge = m_drain_detector.GetLastDischarge() > 0 ? m_drain_detector.GetLastDischarge() : 0.0;
+    state.baselineMean = baseline.mean;
+    state.baselineStddev = sqrt(baseline.Variance());
+
+    // An acknowledgement made since this sample started has already cleared the alert
+    std::lock_guard<std::mutex> lock(m_drain_lock);
+    state.alerting = alerting && !m_acknowledge_alert;
+    m_drain_state = state;
+    CDataManager::Instance().m_drain_alert = state.alerting;
+}
+
+CBatteryPowerRatePlugin::DrainState CBatteryPowerRatePlugin::GetDrainState() const
+{
+    std::lock_guard<std::mutex> lock(m_drain_lock);
+    return m_drain_state;
+}
+
+void CBatteryPowerRatePlugin::PublishSample()
+{
+    const CDataManager& data = CDataManager::Instance();
+    if (!data.m_publish_shm)
+    {
+        m_shm_publisher.Close();
+        return;
+    }
+
+    BatteryPowerSample sample = {};
+    sample.time_ms = static_cast<int64_t>(data.m_cur_sample.timeMs);
+    sample.battery_rate_mw = static_cast<int32_t>(llround(data.m_cur_battery_rate.ToDouble() * 1000.0));
+    sample.system_power_mw = static_cast<int32_t>(llround(data.m_cur_system_power.ToDouble() * 1000.0));
+    if (data.m_drain_alert)
+        sample.flags |= BATTERY_POWER_FLAG_DRAIN_ALERT;
+    if (data.m_cur_sample.event != CSampleTimeline::SE_NONE)
+        sample.flags |= BATTERY_POWER_FLAG_RESUMED;
+    m_shm_publisher.Publish(sample);
 }
 
 const wchar_t* CBatteryPowerRatePlugin::GetInfo(PluginInfoIndex index)
@@ -322,9 +405,159 @@ const wchar_t* CBatteryPowerRatePlugin::GetTooltipInfo()
 {   
 	static CString str;
 	str.Format(L"Battery power rate: %s", m_battery_power.GetItemValueText());
+	DrainState drain = GetDrainState();
+	if (drain.alerting)
+		str += L"\r\n" + FormatDrainAlert(drain);
+	str += FormatEnergy();
+	str += FormatTopConsumers();
 	return str;
 }
 
+CString CBatteryPowerRatePlugin::FormatTopConsumers() const
+{
+    const auto top = m_process_power.GetTopConsumers();
+    if (top.empty())
+        return CString();
+
+    CString text = L"\r\nTop power consumers:";
+    for (const auto& process : top)
+    {
+        CString line;
+        // Without a measured system draw (e.g. on AC) only the CPU share is meaningful
+        if (process.watts > 0)
+            line.Format(L"\r\n  %s (%u): %.2f W (%.0f%%)", process.name.c_str(), process.pid, process.watts, process.share * 100.0);
+        else
+            line.Format(L"\r\n  %s (%u): %.0f%%", process.name.c_str(), process.pid, process.share * 100.0);
+        text += line;
+    }
+    return text;
+}
+
+CString CBatteryPowerRatePlugin::FormatEnergy() const
+{
+    const CDataManager& data = CDataManager::Instance();
+    wchar_t discharged[24], charged[24];
+    data.m_energy_discharged.Format(discharged, _countof(discharged), 2);
+    data.m_energy_charged.Format(charged, _countof(charged), 2);
+
+    CString text;
+    text.Format(L"\r\nEnergy since start: %s Wh discharged, %s Wh charged", discharged, charged);
+    return text;
+}
+
+void CBatteryPowerRatePlugin::OnExtenedInfo(ExtendedInfoIndex index, const wchar_t* data)
+{
+    switch (index)
+    {
+    case EI_LABEL_TEXT_COLOR:
+        CDataManager::Instance().m_label_color = wcstoul(data, nullptr, 10);
+        CDataManager::Instance().m_has_label_color = true;
+        break;
+    case EI_VALUE_TEXT_COLOR:
+        CDataManager::Instance().m_value_color = wcstoul(data, nullptr, 10);
+        CDataManager::Instance().m_has_value_color = true;
+        break;
+    case EI_CONFIG_DIR:
+        // The next sample loads the drain baselines from the new file
+        CDataManager::Instance().SetConfigDir(data);
+        break;
+    default:
+        break;
+    }
+}
+
+int CBatteryPowerRatePlugin::GetCommandCount()
+{
+    return CMD_MAX;
+}
+
+const wchar_t* CBatteryPowerRatePlugin::GetCommandName(int command_index)
+{
+    switch (command_index)
+    {
+    case CMD_SHOW_TOP_CONSUMERS:
+        return L"Show top power consumers";
+    case CMD_DRAIN_ALERT:
+        return L"Abnormal drain alert";
+    case CMD_PUBLISH_SHM:
+        return L"Publish to shared memory";
+    default:
+        break;
+    }
+    return nullptr;
+}
+
+void CBatteryPowerRatePlugin::OnPluginCommand(int command_index, void* hWnd, void* para)
+{
+    AFX_MANAGE_STATE(AfxGetStaticModuleState());
+    switch (command_index)
+    {
+    case CMD_SHOW_TOP_CONSUMERS:
+    {
+        CString text = FormatTopConsumers();
+        if (text.IsEmpty())
+            text = L"No process power data collected yet.";
+        else
+            text.TrimLeft();
+        MessageBox((HWND)hWnd, text, L"Battery Power Rate", MB_OK | MB_ICONINFORMATION);
+        break;
+    }
+    case CMD_DRAIN_ALERT:
+    {
+        // Show the details; acknowledging accepts the current drain as normal
+        DrainState state = GetDrainState();
+        bool alerting = state.alerting;
+        CString text = FormatDrainAlert(state);
+        if (alerting)
+            text += L"\r\n\r\nAcknowledge the alert and treat this drain as normal?";
+        UINT type = alerting ? (MB_YESNO | MB_ICONWARNING) : (MB_OK | MB_ICONINFORMATION);
+        if (MessageBox((HWND)hWnd, text, L"Battery Power Rate", type) == IDYES)
+        {
+            // The detector belongs to the sampling thread, the next sample applies it.
+            // Until then the published state shows the alert as cleared.
+            std::lock_guard<std::mutex> lock(m_drain_lock);
+            m_acknowledge_alert = true;
+            m_drain_state.alerting = false;
+            CDataManager::Instance().m_drain_alert = false;
+        }
+        break;
+    }
+    case CMD_PUBLISH_SHM:
+    {
+        // Takes effect with the next sample
+        CDataManager& data = CDataManager::Instance();
+        data.m_publish_shm = !data.m_publish_shm;
+        data.SaveConfig();
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+int CBatteryPowerRatePlugin::IsCommandChecked(int command_index)
+{
+    switch (command_index)
+    {
+    case CMD_DRAIN_ALERT:
+        return GetDrainState().alerting ? 1 : 0;
+    case CMD_PUBLISH_SHM:
+        return CDataManager::Instance().m_publish_shm ? 1 : 0;
+    default:
+        break;
+    }
+    return 0;
+}
+
+CString CBatteryPowerRatePlugin::FormatDrainAlert(const DrainState& state)
+{
+    CString text;
+    text.Format(L"%s: drawing %.2f W, usual for this hour %.2f W (+/- %.2f W)",
+        state.alerting ? L"Abnormal drain" : L"Drain normal",
+        state.discharge, state.baselineMean, state.baselineStddev);
+    return text;
+}
+
 ITMPlugin* TMPluginGetInstance()
 {
     AFX_MANAGE_STATE(AfxGetStaticModuleState());
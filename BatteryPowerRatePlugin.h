@@ -1,6 +1,14 @@
 ﻿#pragma once
 #include "PluginInterface.h"
 #include "BatteryPower.h"
+#include "ProcessPowerAttribution.h"
+#include "BatteryDevices.h"
+#include "SampleTimeline.h"
+#include "AnomalyDetector.h"
+#include "ShmPublisher.h"
+#include <atomic>
+#include <mutex>
+#include <string>
 
 class CBatteryPowerRatePlugin : public ITMPlugin
 {
@@ -15,9 +23,54 @@ public:
     virtual void DataRequired() override;
     virtual const wchar_t* GetInfo(PluginInfoIndex index) override;
     virtual const wchar_t* GetTooltipInfo();
+    virtual void OnExtenedInfo(ExtendedInfoIndex index, const wchar_t* data) override;
+    virtual int GetCommandCount() override;
+    virtual const wchar_t* GetCommandName(int command_index) override;
+    virtual void OnPluginCommand(int command_index, void* hWnd, void* para) override;
+    virtual int IsCommandChecked(int command_index) override;
+
+    enum Command
+    {
+        CMD_SHOW_TOP_CONSUMERS,
+        CMD_DRAIN_ALERT,
+        CMD_PUBLISH_SHM,
+        CMD_MAX
+    };
 
 private:
+    // What the UI shows of the drain detector, which itself belongs to the sampling thread
+    struct DrainState
+    {
+        bool alerting = false;
+        double discharge = 0;       // Watts of the last sample, 0 when not discharging
+        double baselineMean = 0;
+        double baselineStddev = 0;
+    };
+
+    static void CALLBACK FirstSampleCallback(PTP_CALLBACK_INSTANCE instance, PVOID context);
+    void UpdateData();
+    void PublishSample();
+    CString FormatEnergy() const;
+    CString FormatTopConsumers() const;
+    void PublishDrainState(bool alerting);
+    DrainState GetDrainState() const;
+    static CString FormatDrainAlert(const DrainState& state);
+
     CBatteryPowerPlugin m_battery_power;
+    CBatteryDevices m_batteries;
+    CProcessPowerAttribution m_process_power;
+    CSampleTimeline m_timeline;
+    CAnomalyDetector m_drain_detector;
+    CShmPublisher m_shm_publisher;
+
+    bool m_first_sample_started = false;
+    std::atomic<bool> m_first_sample_done{ false };
+    std::atomic<bool> m_acknowledge_alert{ false }; // Set on the UI thread, applied by the next sample
+    DrainState m_drain_state;
+    mutable std::mutex m_drain_lock;                // Guards m_drain_state
+    std::wstring m_baselines_path;                  // Configuration file the drain baselines came from
+    unsigned long long m_baselines_saved_ms = 0;
+    HMODULE m_callback_module = NULL;               // Released when FirstSampleCallback() returns
 
     static CBatteryPowerRatePlugin m_instance;
 };
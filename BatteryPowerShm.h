@@ -0,0 +1,44 @@
+/*
+ * Layout of the shared-memory segment the plugin publishes its readings into.
+ * Plain C so other tools can include it; see reader/BatteryPowerShmReader.h.
+ *
+ * The segment is protected by a sequence lock: the writer increments `sequence` before and
+ * after every update, so it is odd while an update is in progress. A reader copies the data
+ * between two reads of `sequence` and retries unless both are equal and even.
+ */
+#ifndef BATTERY_POWER_SHM_H
+#define BATTERY_POWER_SHM_H
+
+#include <stdint.h>
+
+#define BATTERY_POWER_SHM_NAME      L"Local\\BatteryPowerRatePlugin"
+#define BATTERY_POWER_SHM_MAGIC     0x52504250u     /* "BPPR" */
+#define BATTERY_POWER_SHM_VERSION   1u
+#define BATTERY_POWER_SHM_HISTORY   64u
+
+/* BatteryPowerSample::flags */
+#define BATTERY_POWER_FLAG_DRAIN_ALERT  0x1u    /* Sustained abnormal drain is flagged */
+#define BATTERY_POWER_FLAG_RESUMED      0x2u    /* First sample after a suspend or a gap */
+
+typedef struct BatteryPowerSample
+{
+    int64_t time_ms;            /* Awake time of the system when the sample was taken */
+    int32_t battery_rate_mw;    /* Positive while charging, negative while discharging */
+    int32_t system_power_mw;    /* Power drawn by the system, 0 when unknown */
+    uint32_t flags;
+    uint32_t reserved;
+} BatteryPowerSample;
+
+typedef struct BatteryPowerShm
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;              /* sizeof(BatteryPowerShm) of the writer */
+    uint32_t history_capacity;
+    volatile uint32_t sequence; /* Odd while the writer is updating */
+    uint32_t history_count;     /* Samples published so far; the newest is at (history_count - 1) % capacity */
+    BatteryPowerSample latest;
+    BatteryPowerSample history[BATTERY_POWER_SHM_HISTORY];
+} BatteryPowerShm;
+
+#endif /* BATTERY_POWER_SHM_H */
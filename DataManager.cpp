@@ -4,6 +4,7 @@
 CDataManager CDataManager::m_instance;
 
 CDataManager::CDataManager()
+    : m_cur_b_rate(L"-- W")
 {
 }
 
@@ -12,3 +13,80 @@ CDataManager& CDataManager::Instance()
 {
     return m_instance;
 }
+
+void CDataManager::AccumulateEnergy(unsigned long long intervalMs)
+{
+    EnergyWattHours energy = IntegrateEnergy(m_cur_battery_rate, intervalMs);
+    if (energy < EnergyWattHours())
+        m_energy_discharged -= energy;
+    else
+        m_energy_charged += energy;
+}
+
+void CDataManager::SetConfigDir(const wchar_t* config_dir)
+{
+    std::wstring path = config_dir;
+    if (!path.empty() && path.back() != L'\\')
+        path += L'\\';
+    path += L"BatteryPowerRatePlugin.ini";
+
+    m_publish_shm = GetPrivateProfileInt(L"config", L"publish_shm", 0, path.c_str()) != 0;
+
+    wchar_t buffer[32];
+    GetPrivateProfileString(L"data", L"last_value", L"", buffer, _countof(buffer), path.c_str());
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_config_path = path;
+    m_saved_value = buffer;
+    if (!m_has_sample && !m_saved_value.empty())
+        m_cur_b_rate = m_saved_value;
+}
+
+std::wstring CDataManager::GetConfigPath() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_config_path;
+}
+
+void CDataManager::SetValueText(const std::wstring& text)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_cur_b_rate = text;
+    m_has_sample = true;
+}
+
+std::wstring CDataManager::GetValueText() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_cur_b_rate;
+}
+
+void CDataManager::SaveLastValue(unsigned long long timeMs)
+{
+    const unsigned long long SAVE_INTERVAL_MS = 60000;
+
+    // Only the sampling thread saves, so the file is written outside the lock
+    std::wstring value, path;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_config_path.empty() || m_cur_b_rate == m_saved_value)
+            return;
+        if (m_value_saved && timeMs - m_last_save_ms < SAVE_INTERVAL_MS)
+            return;
+
+        value = m_cur_b_rate;
+        path = m_config_path;
+        m_saved_value = value;
+        m_last_save_ms = timeMs;
+        m_value_saved = true;
+    }
+    WritePrivateProfileString(L"data", L"last_value", value.c_str(), path.c_str());
+}
+
+void CDataManager::SaveConfig()
+{
+    std::wstring path = GetConfigPath();
+    if (path.empty())
+        return;
+    WritePrivateProfileString(L"config", L"publish_shm", m_publish_shm ? L"1" : L"0", path.c_str());
+}
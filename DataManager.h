@@ -1,5 +1,10 @@
 ﻿#pragma once
+#include <Windows.h>
+#include <atomic>
+#include <mutex>
 #include <string>
+#include "PowerValue.h"
+#include "SampleTimeline.h"
 
 class CDataManager
 {
@@ -10,8 +15,55 @@ public:
     static CDataManager& Instance();
 
 public:
-    std::wstring m_cur_b_rate;
+    // Integrates the current battery rate over the given interval
+    void AccumulateEnergy(unsigned long long intervalMs);
+
+    // Sets the directory of the configuration file and restores the last persisted value,
+    // so the first tick has something to show before the batteries have been read
+    void SetConfigDir(const wchar_t* config_dir);
+
+    // Persists the current value, at most once a minute and only when it changed
+    void SaveLastValue(unsigned long long timeMs);
+
+    // Writes the options to the configuration file
+    void SaveConfig();
+
+    // Empty until TrafficMonitor has passed the configuration directory
+    std::wstring GetConfigPath() const;
+
+    // Text shown as the item's value. Setting it marks the first sample as taken, so the
+    // persisted value no longer replaces it.
+    void SetValueText(const std::wstring& text);
+    std::wstring GetValueText() const;
+
+public:
+    CSampleTimeline::Sample m_cur_sample;   // When the current values were read
+    PowerWatts m_cur_battery_rate;      // Positive while charging, negative while discharging
+    PowerWatts m_cur_system_power;      // Power drawn by the system, 0 when unknown (e.g. while charging)
+    bool m_system_power_measured{};     // m_cur_system_power is the battery discharge rate, not an estimate
+    EnergyWattHours m_energy_discharged;
+    EnergyWattHours m_energy_charged;
+    std::atomic<bool> m_drain_alert{};  // Sustained abnormal drain detected; also read by the UI
+
+    // Options
+    bool m_publish_shm{};               // Publish the samples to shared memory for other tools
+
+    // Text colors passed by TrafficMonitor through OnExtenedInfo()
+    COLORREF m_label_color{};
+    COLORREF m_value_color{};
+    bool m_has_label_color{};
+    bool m_has_value_color{};
 
 private:
+    // SetConfigDir() runs on the UI thread while the first sample may be taken on the
+    // thread pool, so the members below are only accessed under the lock
+    mutable std::mutex m_lock;
+    std::wstring m_config_path;
+    std::wstring m_cur_b_rate;
+    std::wstring m_saved_value;
+    unsigned long long m_last_save_ms{};
+    bool m_has_sample{};
+    bool m_value_saved{};
+
     static CDataManager m_instance;
 };
@@ -0,0 +1,157 @@
+#pragma once
+#include <cwchar>
+
+// Fixed-point number stored as an integer count of 1/Scale units.
+// All arithmetic, rounding and formatting stay in integers, so results are bit-identical
+// on every compiler and platform.
+template <typename Rep, Rep Scale>
+class TFixedPoint
+{
+public:
+    TFixedPoint() : m_raw(0) {}
+
+    static TFixedPoint FromRaw(Rep raw)
+    {
+        TFixedPoint value;
+        value.m_raw = raw;
+        return value;
+    }
+
+    // Converts a value given in 1/unitsPerWhole units, e.g. FromUnits(rate, 1000) for milliwatts
+    static TFixedPoint FromUnits(Rep units, Rep unitsPerWhole)
+    {
+        if (unitsPerWhole == Scale)
+            return FromRaw(units);
+        return FromRaw(RoundDiv(units * Scale, unitsPerWhole));
+    }
+
+    static TFixedPoint FromDouble(double value)
+    {
+        double raw = value * Scale;
+        return FromRaw(static_cast<Rep>(raw < 0 ? raw - 0.5 : raw + 0.5));
+    }
+
+    Rep Raw() const { return m_raw; }
+    double ToDouble() const { return static_cast<double>(m_raw) / Scale; }
+    TFixedPoint Abs() const { return FromRaw(m_raw < 0 ? -m_raw : m_raw); }
+
+    TFixedPoint operator-() const { return FromRaw(-m_raw); }
+    TFixedPoint operator+(TFixedPoint other) const { return FromRaw(m_raw + other.m_raw); }
+    TFixedPoint operator-(TFixedPoint other) const { return FromRaw(m_raw - other.m_raw); }
+    TFixedPoint operator*(Rep factor) const { return FromRaw(m_raw * factor); }
+    TFixedPoint operator/(Rep divisor) const { return FromRaw(RoundDiv(m_raw, divisor)); }
+    TFixedPoint& operator+=(TFixedPoint other) { m_raw += other.m_raw; return *this; }
+    TFixedPoint& operator-=(TFixedPoint other) { m_raw -= other.m_raw; return *this; }
+
+    bool operator<(TFixedPoint other) const { return m_raw < other.m_raw; }
+    bool operator>(TFixedPoint other) const { return m_raw > other.m_raw; }
+    bool operator<=(TFixedPoint other) const { return m_raw <= other.m_raw; }
+    bool operator>=(TFixedPoint other) const { return m_raw >= other.m_raw; }
+    bool operator==(TFixedPoint other) const { return m_raw == other.m_raw; }
+    bool operator!=(TFixedPoint other) const { return m_raw != other.m_raw; }
+
+    // Writes the value rounded to the given number of decimals, like "%.*f" would
+    void Format(wchar_t* buffer, size_t size, int decimals) const
+    {
+        Rep divisor = 1;
+        for (int i = 0; i < decimals; i++)
+            divisor *= 10;
+
+        Rep scaled = RoundDiv(m_raw * divisor, Scale);
+        const wchar_t* sign = scaled < 0 ? L"-" : L"";
+        if (scaled < 0)
+            scaled = -scaled;
+
+        if (decimals > 0)
+            swprintf_s(buffer, size, L"%s%lld.%0*lld", sign, static_cast<long long>(scaled / divisor),
+                decimals, static_cast<long long>(scaled % divisor));
+        else
+            swprintf_s(buffer, size, L"%s%lld", sign, static_cast<long long>(scaled));
+    }
+
+private:
+    // Integer division rounding half away from zero
+    static Rep RoundDiv(Rep numerator, Rep denominator)
+    {
+        if (denominator < 0)
+        {
+            numerator = -numerator;
+            denominator = -denominator;
+        }
+        Rep half = denominator / 2;
+        return numerator < 0 ? (numerator - half) / denominator : (numerator + half) / denominator;
+    }
+
+    Rep m_raw;
+};
+
+// Floating-point counterpart of TFixedPoint with the same interface
+template <typename T>
+class TFloatingPoint
+{
+public:
+    TFloatingPoint() : m_value(0) {}
+
+    static TFloatingPoint FromUnits(long long units, long long unitsPerWhole) { return FromDouble(static_cast<T>(units) / unitsPerWhole); }
+    static TFloatingPoint FromDouble(double value)
+    {
+        TFloatingPoint result;
+        result.m_value = static_cast<T>(value);
+        return result;
+    }
+
+    double ToDouble() const { return m_value; }
+    TFloatingPoint Abs() const { return FromDouble(m_value < 0 ? -m_value : m_value); }
+
+    TFloatingPoint operator-() const { return FromDouble(-m_value); }
+    TFloatingPoint operator+(TFloatingPoint other) const { return FromDouble(m_value + other.m_value); }
+    TFloatingPoint operator-(TFloatingPoint other) const { return FromDouble(m_value - other.m_value); }
+    TFloatingPoint operator*(long long factor) const { return FromDouble(m_value * factor); }
+    TFloatingPoint operator/(long long divisor) const { return FromDouble(m_value / divisor); }
+    TFloatingPoint& operator+=(TFloatingPoint other) { m_value += other.m_value; return *this; }
+    TFloatingPoint& operator-=(TFloatingPoint other) { m_value -= other.m_value; return *this; }
+
+    bool operator<(TFloatingPoint other) const { return m_value < other.m_value; }
+    bool operator>(TFloatingPoint other) const { return m_value > other.m_value; }
+    bool operator<=(TFloatingPoint other) const { return m_value <= other.m_value; }
+    bool operator>=(TFloatingPoint other) const { return m_value >= other.m_value; }
+    bool operator==(TFloatingPoint other) const { return m_value == other.m_value; }
+    bool operator!=(TFloatingPoint other) const { return m_value != other.m_value; }
+
+    void Format(wchar_t* buffer, size_t size, int decimals) const
+    {
+        swprintf_s(buffer, size, L"%.*f", decimals, static_cast<double>(m_value));
+    }
+
+private:
+    T m_value;
+};
+
+// Both representations of power and energy. The fixed-point power is in milliwatts, the
+// energy in milliwatt-milliseconds.
+typedef TFixedPoint<long long, 1000> FixedPowerWatts;
+typedef TFixedPoint<long long, 3600000000LL> FixedEnergyWattHours;
+typedef TFloatingPoint<double> FloatPowerWatts;
+typedef TFloatingPoint<double> FloatEnergyWattHours;
+
+// Energy drawn at the given power over the given time
+inline FixedEnergyWattHours IntegrateEnergy(FixedPowerWatts power, unsigned long long milliseconds)
+{
+    return FixedEnergyWattHours::FromRaw(power.Raw() * static_cast<long long>(milliseconds));
+}
+
+inline FloatEnergyWattHours IntegrateEnergy(FloatPowerWatts power, unsigned long long milliseconds)
+{
+    return FloatEnergyWattHours::FromDouble(power.ToDouble() * milliseconds / 3600000.0);
+}
+
+// Types used by the sample pipeline. Define BATTERY_POWER_FIXED_POINT (the ReleaseFixedPoint
+// configuration does) to run smoothing, thresholds, energy integration and formatting
+// entirely in integers.
+#ifdef BATTERY_POWER_FIXED_POINT
+typedef FixedPowerWatts PowerWatts;
+typedef FixedEnergyWattHours EnergyWattHours;
+#else
+typedef FloatPowerWatts PowerWatts;
+typedef FloatEnergyWattHours EnergyWattHours;
+#endif
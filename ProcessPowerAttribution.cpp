@@ -0,0 +1,314 @@
+#include "pch.h"
+#include "ProcessPowerAttribution.h"
+
+#include <TlHelp32.h>
+#include <algorithm>
+
+namespace
+{
+    const size_t INITIAL_CAPACITY = 1024;
+
+    // Upper bound on the time one scan may take, so thousands of processes never stall a tick
+    const LONGLONG SCAN_BUDGET_MS = 20;
+
+    // OpenProcess() is the expensive part of a cold scan, spread it over several ticks
+    const size_t MAX_OPENS_PER_SCAN = 256;
+
+    const size_t MIN_SAMPLES_PER_SCAN = 16;
+
+    ULONGLONG FileTimeToUInt64(const FILETIME& ft)
+    {
+        ULARGE_INTEGER value;
+        value.LowPart = ft.dwLowDateTime;
+        value.HighPart = ft.dwHighDateTime;
+        return value.QuadPart;
+    }
+
+    // Kernel + user time of all processors minus their idle time, 100 ns units
+    bool GetSystemBusyTime(ULONGLONG& busyTime)
+    {
+        FILETIME idleTime, kernelTime, userTime;
+        if (!GetSystemTimes(&idleTime, &kernelTime, &userTime))
+            return false;
+        busyTime = FileTimeToUInt64(kernelTime) + FileTimeToUInt64(userTime) - FileTimeToUInt64(idleTime);
+        return true;
+    }
+
+    bool GetProcessCpuTime(HANDLE hProcess, ULONGLONG& cpuTime)
+    {
+        FILETIME creationTime, exitTime, kernelTime, userTime;
+        if (!GetProcessTimes(hProcess, &creationTime, &exitTime, &kernelTime, &userTime))
+            return false;
+        cpuTime = FileTimeToUInt64(kernelTime) + FileTimeToUInt64(userTime);
+        return true;
+    }
+}
+
+CProcessPowerAttribution::CProcessPowerAttribution()
+{
+    // The table is allocated on the first Update() so constructing the plugin at DLL load stays cheap
+}
+
+CProcessPowerAttribution::~CProcessPowerAttribution()
+{
+    Reset();
+}
+
+void CProcessPowerAttribution::Reset()
+{
+    for (Slot& slot : m_slots)
+    {
+        if (slot.pid != 0)
+            CloseSlot(slot);
+    }
+    m_slots.clear();
+    m_count = 0;
+
+    std::lock_guard<std::mutex> lock(m_top_lock);
+    m_top.clear();
+}
+
+std::vector<CProcessPowerAttribution::ProcessPower> CProcessPowerAttribution::GetTopConsumers() const
+{
+    std::lock_guard<std::mutex> lock(m_top_lock);
+    return m_top;
+}
+
+void CProcessPowerAttribution::Update(double totalWatts)
+{
+    // The budget covers the snapshot too, it is the slowest single call of a scan
+    LARGE_INTEGER frequency, start, now;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+    const LONGLONG budget = frequency.QuadPart * SCAN_BUDGET_MS / 1000;
+
+    // Every process is measured against the busy time of the whole system over the same
+    // window, so the processes read this scan never split up the time of the others
+    ULONGLONG systemBusy;
+    if (!GetSystemBusyTime(systemBusy))
+        return;
+
+    HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (hSnapshot == INVALID_HANDLE_VALUE)
+        return;
+
+    if (m_slots.empty())
+        m_slots.resize(INITIAL_CAPACITY);
+    ++m_generation;
+
+    // Walking the snapshot is cheap, so every scan records the complete process list
+    PROCESSENTRY32W pe = { 0 };
+    pe.dwSize = sizeof(pe);
+    for (BOOL ok = Process32FirstW(hSnapshot, &pe); ok; ok = Process32NextW(hSnapshot, &pe))
+    {
+        // Skip the System Idle Process, its CPU time is idle time
+        if (pe.th32ProcessID == 0)
+            continue;
+
+        size_t index = Find(pe.th32ProcessID);
+        if (index == SIZE_MAX)
+        {
+            if ((m_count + 1) * 2 > m_slots.size())
+                Grow();
+            index = Insert(pe.th32ProcessID);
+            m_slots[index].baselineEpoch = m_rebase_epoch;
+        }
+
+        // Processes we cannot open keep a placeholder entry so OpenProcess() is not retried every
+        // tick, but without a handle their PID may have been reused
+        Slot& slot = m_slots[index];
+        if (!slot.hProcess)
+            slot.name = pe.szExeFile;
+        slot.seenGeneration = m_generation;
+    }
+    CloseHandle(hSnapshot);
+
+    // Drop processes that have exited, closing their handles lets the system free them
+    m_stale.clear();
+    for (const Slot& slot : m_slots)
+    {
+        if (slot.pid != 0 && slot.seenGeneration != m_generation)
+            m_stale.push_back(slot.pid);
+    }
+    for (DWORD pid : m_stale)
+        Erase(Find(pid));
+
+    // Read CPU times starting where the previous scan ran out of budget. The slots no longer
+    // move until the next scan.
+    const size_t mask = m_slots.size() - 1;
+    size_t index = m_cursor & mask;
+    size_t opened = 0;
+    size_t sampled = 0;
+    for (size_t visited = 0; visited < m_slots.size(); visited++, index = (index + 1) & mask)
+    {
+        Slot& slot = m_slots[index];
+        if (slot.pid == 0)
+            continue;
+
+        // Every scan reads a few processes, so the cursor moves on even when the snapshot was slow
+        QueryPerformanceCounter(&now);
+        if (++sampled > MIN_SAMPLES_PER_SCAN && now.QuadPart - start.QuadPart > budget)
+            break;
+
+        SampleSlot(slot, systemBusy, opened);
+    }
+    m_cursor = index;
+
+    // Processes the budget left out this scan compete with their share from the last reading
+    m_candidates.clear();
+    for (size_t i = 0; i < m_slots.size(); i++)
+    {
+        const Slot& slot = m_slots[i];
+        if (slot.pid != 0 && slot.share > 0)
+            m_candidates.push_back(i);
+    }
+
+    // Build the list aside so a reader never sees it half filled
+    m_next_top.clear();
+    size_t topCount = TOP_COUNT;
+    if (m_candidates.size() < topCount)
+        topCount = m_candidates.size();
+    std::partial_sort(m_candidates.begin(), m_candidates.begin() + topCount, m_candidates.end(),
+        [this](size_t a, size_t b) { return m_slots[a].share > m_slots[b].share; });
+
+    for (size_t i = 0; i < topCount; i++)
+    {
+        const Slot& slot = m_slots[m_candidates[i]];
+        ProcessPower process;
+        process.pid = slot.pid;
+        process.name = slot.name;
+        process.share = slot.share;
+        process.watts = totalWatts * process.share;
+        m_next_top.push_back(process);
+    }
+
+    std::lock_guard<std::mutex> lock(m_top_lock);
+    m_top.swap(m_next_top);
+}
+
+void CProcessPowerAttribution::SampleSlot(Slot& slot, ULONGLONG systemBusy, size_t& opened)
+{
+    slot.share = 0;
+    if (!slot.opened)
+    {
+        // OpenProcess() is the expensive part of a cold scan, the rest waits for the next one
+        if (opened >= MAX_OPENS_PER_SCAN)
+            return;
+        ++opened;
+        slot.opened = true;
+        slot.hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, slot.pid);
+
+        // First sighting only establishes the CPU time baseline
+        if (slot.hProcess && GetProcessCpuTime(slot.hProcess, slot.lastCpuTime))
+            slot.lastSystemBusy = systemBusy;
+        return;
+    }
+
+    ULONGLONG cpuTime;
+    if (!slot.hProcess || !GetProcessCpuTime(slot.hProcess, cpuTime))
+        return;
+
+    // A slot visited several scans ago is compared with the system's busy time over the same
+    // longer window. The system time is read once per scan, so a share can exceed 1 slightly.
+    if (slot.baselineEpoch == m_rebase_epoch && cpuTime > slot.lastCpuTime && systemBusy > slot.lastSystemBusy)
+    {
+        slot.share = static_cast<double>(cpuTime - slot.lastCpuTime) / (systemBusy - slot.lastSystemBusy);
+        if (slot.share > 1)
+            slot.share = 1;
+    }
+    slot.baselineEpoch = m_rebase_epoch;
+    slot.lastCpuTime = cpuTime;
+    slot.lastSystemBusy = systemBusy;
+}
+
+size_t CProcessPowerAttribution::HomeIndex(DWORD pid) const
+{
+    // Windows PIDs are multiples of 4, drop the low bits before the Fibonacci hash
+    return static_cast<size_t>(((pid >> 2) * 2654435761u) & (m_slots.size() - 1));
+}
+
+size_t CProcessPowerAttribution::Find(DWORD pid) const
+{
+    if (m_slots.empty())
+        return SIZE_MAX;
+
+    const size_t mask = m_slots.size() - 1;
+    for (size_t index = HomeIndex(pid); m_slots[index].pid != 0; index = (index + 1) & mask)
+    {
+        if (m_slots[index].pid == pid)
+            return index;
+    }
+    return SIZE_MAX;
+}
+
+size_t CProcessPowerAttribution::Insert(DWORD pid)
+{
+    const size_t mask = m_slots.size() - 1;
+    size_t index = HomeIndex(pid);
+    while (m_slots[index].pid != 0)
+        index = (index + 1) & mask;
+
+    Slot& slot = m_slots[index];
+    slot.pid = pid;
+    slot.hProcess = NULL;
+    slot.opened = false;
+    slot.lastCpuTime = 0;
+    slot.lastSystemBusy = 0;
+    slot.share = 0;
+    slot.seenGeneration = 0;
+    slot.baselineEpoch = 0;
+    slot.name.clear();
+    ++m_count;
+    return index;
+}
+
+void CProcessPowerAttribution::Erase(size_t index)
+{
+    CloseSlot(m_slots[index]);
+
+    // Backward-shift deletion keeps linear probing chains intact without tombstones
+    const size_t mask = m_slots.size() - 1;
+    size_t hole = index;
+    for (size_t next = (hole + 1) & mask; m_slots[next].pid != 0; next = (next + 1) & mask)
+    {
+        size_t home = HomeIndex(m_slots[next].pid);
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            m_slots[hole] = std::move(m_slots[next]);
+            hole = next;
+        }
+    }
+
+    Slot& empty = m_slots[hole];
+    empty.pid = 0;
+    empty.hProcess = NULL;
+    empty.name.clear();
+    --m_count;
+}
+
+void CProcessPowerAttribution::Grow()
+{
+    std::vector<Slot> old;
+    old.swap(m_slots);
+    m_slots.resize(old.size() * 2);
+
+    const size_t mask = m_slots.size() - 1;
+    for (Slot& slot : old)
+    {
+        if (slot.pid == 0)
+            continue;
+        size_t index = HomeIndex(slot.pid);
+        while (m_slots[index].pid != 0)
+            index = (index + 1) & mask;
+        m_slots[index] = std::move(slot);
+    }
+}
+
+void CProcessPowerAttribution::CloseSlot(Slot& slot)
+{
+    if (slot.hProcess)
+    {
+        CloseHandle(slot.hProcess);
+        slot.hProcess = NULL;
+    }
+}
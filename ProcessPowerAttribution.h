@@ -0,0 +1,86 @@
+#pragma once
+#include <Windows.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Apportions the measured system power to processes in proportion to their share of the
+// system's busy CPU time (GetSystemTimes()) since each process was last read. Processes that
+// cannot be opened or were not read this scan keep their part of the busy time, so it is
+// never credited to the others.
+class CProcessPowerAttribution
+{
+public:
+    struct ProcessPower
+    {
+        DWORD pid;
+        std::wstring name;
+        double watts;
+        double share;       // Fraction of the system's busy CPU time the process consumed (0..1)
+    };
+
+    CProcessPowerAttribution();
+    ~CProcessPowerAttribution();
+
+    CProcessPowerAttribution(const CProcessPowerAttribution&) = delete;
+    CProcessPowerAttribution& operator=(const CProcessPowerAttribution&) = delete;
+
+    // Scans the running processes and splits totalWatts between them. Pass 0 when the system
+    // power is not measured; only the shares are filled in then.
+    // Exited processes are dropped on every scan. Reading CPU times stops once the time budget
+    // is spent; the next scan continues where this one stopped.
+    void Update(double totalWatts);
+
+    // Closes all process handles and empties the table
+    void Reset();
+
+    // Makes the next visit of every process only refresh its CPU time baseline, e.g. after resume.
+    // Unlike Reset() the process handles stay open.
+    void Rebase() { ++m_rebase_epoch; }
+
+    // Safe to call from another thread while Update() runs; returns a copy of the latest list
+    std::vector<ProcessPower> GetTopConsumers() const;
+
+    static const size_t TOP_COUNT = 5;
+
+private:
+    friend struct ProcessTableTest;     // tests/ProcessTableTest.cpp
+
+    // One entry of the open-addressing PID table. The process handle is kept open between
+    // scans so the PID cannot be reused behind our back and no OpenProcess() is repeated.
+    struct Slot
+    {
+        DWORD pid = 0;                  // 0 marks an empty slot
+        HANDLE hProcess = NULL;         // NULL when the process could not be opened
+        bool opened = false;            // OpenProcess() has been tried
+        ULONGLONG lastCpuTime = 0;      // Kernel + user time, 100 ns units
+        ULONGLONG lastSystemBusy = 0;   // Busy CPU time of the whole system at the lastCpuTime reading
+        double share = 0;               // Of the system's busy time between the last two readings
+        DWORD seenGeneration = 0;       // Scan whose snapshot last listed the process
+        DWORD baselineEpoch = 0;        // Rebase() epoch lastCpuTime belongs to
+        std::wstring name;
+    };
+
+    size_t Find(DWORD pid) const;
+    size_t Insert(DWORD pid);
+    void Erase(size_t index);
+    void Grow();
+    size_t HomeIndex(DWORD pid) const;
+    void CloseSlot(Slot& slot);
+    void SampleSlot(Slot& slot, ULONGLONG systemBusy, size_t& opened);
+
+    std::vector<Slot> m_slots;      // Capacity is always a power of two
+    size_t m_count = 0;
+    DWORD m_generation = 0;
+    DWORD m_rebase_epoch = 0;
+    size_t m_cursor = 0;            // Slot at which the next scan starts reading CPU times
+
+    // Scratch buffers reused across scans to keep Update() allocation free in steady state
+    std::vector<DWORD> m_stale;
+    std::vector<size_t> m_candidates;
+    std::vector<ProcessPower> m_next_top;
+
+    // The finished list of the last scan, swapped in whole under the lock
+    std::vector<ProcessPower> m_top;
+    mutable std::mutex m_top_lock;
+};
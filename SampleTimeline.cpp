@@ -0,0 +1,75 @@
+#include "pch.h"
+#include "SampleTimeline.h"
+
+#pragma comment(lib, "powrprof.lib")
+
+namespace
+{
+    // Samples further apart than this (awake time) are not treated as one interval
+    const ULONGLONG MAX_SAMPLE_INTERVAL_MS = 15000;
+
+    // How much more the wall clock may advance than the awake clock before we assume the
+    // system was suspended. Covers the coarse resolution of both clocks.
+    const ULONGLONG SUSPEND_THRESHOLD_MS = 2000;
+}
+
+CSampleTimeline::CSampleTimeline()
+{
+    // Registration for power notifications waits for the first sample, nothing happens at DLL load
+}
+
+CSampleTimeline::~CSampleTimeline()
+{
+    if (m_power_notify)
+        PowerUnregisterSuspendResumeNotification(m_power_notify);
+}
+
+CSampleTimeline::Sample CSampleTimeline::Advance()
+{
+    // QueryUnbiasedInterruptTime() stops while the system sleeps, GetTickCount64() does not.
+    // Their difference growing between two samples means the system was suspended.
+    ULONGLONG unbiasedTime = 0;
+    QueryUnbiasedInterruptTime(&unbiasedTime);
+    ULONGLONG awakeMs = unbiasedTime / 10000;
+    ULONGLONG wallMs = GetTickCount64();
+
+    Sample sample;
+    sample.timeMs = awakeMs;
+
+    if (!m_started)
+    {
+        m_started = true;
+        m_notify_params.Callback = OnPowerEvent;
+        m_notify_params.Context = this;
+        if (PowerRegisterSuspendResumeNotification(DEVICE_NOTIFY_CALLBACK, &m_notify_params, &m_power_notify) != ERROR_SUCCESS)
+            m_power_notify = NULL;
+        sample.event = SE_FIRST;
+    }
+    else
+    {
+        ULONGLONG awakeDelta = awakeMs - m_last_awake_ms;
+        ULONGLONG wallDelta = wallMs - m_last_wall_ms;
+
+        // The notification alone is not enough, it is not delivered on every system
+        if (m_resume_pending.exchange(false) || wallDelta > awakeDelta + SUSPEND_THRESHOLD_MS)
+            sample.event = SE_RESUME;
+        else if (awakeDelta > MAX_SAMPLE_INTERVAL_MS)
+            sample.event = SE_GAP;
+        else
+        {
+            sample.event = SE_NONE;
+            sample.intervalMs = awakeDelta;
+        }
+    }
+
+    m_last_awake_ms = awakeMs;
+    m_last_wall_ms = wallMs;
+    return sample;
+}
+
+ULONG CALLBACK CSampleTimeline::OnPowerEvent(PVOID context, ULONG type, PVOID setting)
+{
+    if (type == PBT_APMRESUMEAUTOMATIC || type == PBT_APMRESUMESUSPEND)
+        static_cast<CSampleTimeline*>(context)->m_resume_pending = true;
+    return ERROR_SUCCESS;
+}
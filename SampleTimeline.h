@@ -0,0 +1,47 @@
+#pragma once
+#include <Windows.h>
+#include <powrprof.h>
+#include <atomic>
+
+// Monotonic timeline for the samples. Each sample gets a timestamp and the interval since the
+// previous one, or an event telling that the interval is not usable (first sample, resume
+// from sleep, or a stall long enough that deltas would mix unrelated periods).
+class CSampleTimeline
+{
+public:
+    enum Event
+    {
+        SE_NONE,        // Regular sample, intervalMs is valid
+        SE_FIRST,       // First sample, there is no previous one
+        SE_GAP,         // Too much time passed since the previous sample
+        SE_RESUME,      // The system was suspended since the previous sample
+    };
+
+    struct Sample
+    {
+        ULONGLONG timeMs = 0;       // Time the system has been awake, suspended time excluded
+        ULONGLONG intervalMs = 0;   // Awake time since the previous sample, 0 unless event is SE_NONE
+        Event event = SE_FIRST;
+    };
+
+    CSampleTimeline();
+    ~CSampleTimeline();
+
+    CSampleTimeline(const CSampleTimeline&) = delete;
+    CSampleTimeline& operator=(const CSampleTimeline&) = delete;
+
+    // Timestamps a new sample
+    Sample Advance();
+
+private:
+    static ULONG CALLBACK OnPowerEvent(PVOID context, ULONG type, PVOID setting);
+
+    bool m_started = false;
+    ULONGLONG m_last_awake_ms = 0;
+    ULONGLONG m_last_wall_ms = 0;
+
+    // Set from the power notification callback, which runs on a system thread
+    std::atomic<bool> m_resume_pending{ false };
+    DEVICE_NOTIFY_SUBSCRIBE_PARAMETERS m_notify_params = {};
+    HPOWERNOTIFY m_power_notify = NULL;
+};
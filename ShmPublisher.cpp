@@ -0,0 +1,97 @@
+#include "pch.h"
+#include "ShmPublisher.h"
+
+#include <string>
+
+CShmPublisher::CShmPublisher(const wchar_t* name)
+    : m_name(name)
+{
+}
+
+CShmPublisher::~CShmPublisher()
+{
+    Close();
+}
+
+bool CShmPublisher::Open()
+{
+    if (m_shm)
+        return true;
+
+    // Only one writer may own the segment. A second one, e.g. another TrafficMonitor instance
+    // with publishing on, would interleave its updates and "repair" the other's odd sequence.
+    // The object lives as long as its owner's handle, so a writer that died frees it.
+    std::wstring writerName = std::wstring(m_name) + L".Writer";
+    m_writer = CreateEvent(NULL, TRUE, FALSE, writerName.c_str());
+    if (m_writer && GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        CloseHandle(m_writer);
+        m_writer = NULL;
+    }
+    if (!m_writer)
+        return false;
+
+    m_mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(BatteryPowerShm), m_name);
+    if (!m_mapping)
+    {
+        Close();
+        return false;
+    }
+
+    m_shm = static_cast<BatteryPowerShm*>(MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, sizeof(BatteryPowerShm)));
+    if (!m_shm)
+    {
+        Close();
+        return false;
+    }
+
+    // A new mapping is zero-filled, so readers reject it (magic 0) until the header is written.
+    // The mapping may also survive from a previous session while a reader keeps it open;
+    // its history is kept then. As no other writer is alive, an odd sequence was left by
+    // one that died mid-update.
+    if (m_shm->sequence & 1)
+        InterlockedIncrement(reinterpret_cast<volatile LONG*>(&m_shm->sequence));
+    InterlockedIncrement(reinterpret_cast<volatile LONG*>(&m_shm->sequence));
+    if (m_shm->magic != BATTERY_POWER_SHM_MAGIC || m_shm->version != BATTERY_POWER_SHM_VERSION)
+        m_shm->history_count = 0;
+    m_shm->version = BATTERY_POWER_SHM_VERSION;
+    m_shm->size = sizeof(BatteryPowerShm);
+    m_shm->history_capacity = BATTERY_POWER_SHM_HISTORY;
+    m_shm->magic = BATTERY_POWER_SHM_MAGIC;
+    InterlockedIncrement(reinterpret_cast<volatile LONG*>(&m_shm->sequence));
+    return true;
+}
+
+void CShmPublisher::Close()
+{
+    if (m_shm)
+    {
+        UnmapViewOfFile(m_shm);
+        m_shm = nullptr;
+    }
+    if (m_mapping)
+    {
+        CloseHandle(m_mapping);
+        m_mapping = NULL;
+    }
+    if (m_writer)
+    {
+        CloseHandle(m_writer);
+        m_writer = NULL;
+    }
+}
+
+bool CShmPublisher::Publish(const BatteryPowerSample& sample)
+{
+    if (!Open())
+        return false;
+
+    // The interlocked increments are full barriers: the odd value is visible before any of the
+    // data changes, and all of the data before the even value
+    InterlockedIncrement(reinterpret_cast<volatile LONG*>(&m_shm->sequence));
+    m_shm->latest = sample;
+    m_shm->history[m_shm->history_count % BATTERY_POWER_SHM_HISTORY] = sample;
+    m_shm->history_count++;
+    InterlockedIncrement(reinterpret_cast<volatile LONG*>(&m_shm->sequence));
+    return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <Windows.h>
+#include "BatteryPowerShm.h"
+
+// Publishes the latest sample and a short history into a named file mapping, so other
+// tools can read the power data without querying the battery driver themselves.
+class CShmPublisher
+{
+public:
+    explicit CShmPublisher(const wchar_t* name = BATTERY_POWER_SHM_NAME);
+    ~CShmPublisher();
+
+    CShmPublisher(const CShmPublisher&) = delete;
+    CShmPublisher& operator=(const CShmPublisher&) = delete;
+
+    // Creates the mapping on first use and writes the sample under the sequence lock.
+    // Fails while another publisher writes to the same segment.
+    bool Publish(const BatteryPowerSample& sample);
+    void Close();
+
+private:
+    bool Open();
+
+    const wchar_t* m_name;
+    HANDLE m_writer = NULL;         // Named object that exists while a publisher owns the segment
+    HANDLE m_mapping = NULL;
+    BatteryPowerShm* m_shm = nullptr;
+};
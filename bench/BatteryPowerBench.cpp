@@ -0,0 +1,171 @@
+// Timing harness for the plugin. Run from the output directory:
+//
+//   BatteryPowerBench startup [path\to\BatteryPowerRatePlugin.dll]
+//   BatteryPowerBench devices [delay_ms ...]
+//
+// startup  Loads the plugin as TrafficMonitor does and measures how long loading and the
+//          first DataRequired() block the caller, and how long until the first value is shown.
+// devices  Queries simulated batteries that answer after the given delays (default 40 80 120 ms),
+//          once as a single batch and once one battery after another, and reports the time per tick.
+#include <Windows.h>
+#include <cstdio>
+#include <cwchar>
+#include <cwctype>
+#include <vector>
+#include "../PluginInterface.h"
+#include "../BatteryDevices.h"
+
+namespace
+{
+    typedef ITMPlugin* (*TMPluginGetInstanceFunc)();
+
+    // Value text of the item until the first sample has been read
+    const wchar_t* const PLACEHOLDER_VALUE = L"-- W";
+
+    const DWORD FIRST_VALUE_TIMEOUT_MS = 10000;
+
+    // Same limit the plugin uses for one tick
+    const DWORD QUERY_TIMEOUT_MS = 500;
+    const int QUERY_ROUNDS = 10;
+
+    double ElapsedMs(const LARGE_INTEGER& from, const LARGE_INTEGER& to)
+    {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        return (to.QuadPart - from.QuadPart) * 1000.0 / frequency.QuadPart;
+    }
+
+    int RunStartup(const wchar_t* dllPath)
+    {
+        LARGE_INTEGER start, loaded, instance, firstCall, firstValue;
+        QueryPerformanceCounter(&start);
+        HMODULE module = LoadLibrary(dllPath);
+        if (!module)
+        {
+            std::fwprintf(stderr, L"Cannot load %s (error %lu)\n", dllPath, GetLastError());
+            return 1;
+        }
+        QueryPerformanceCounter(&loaded);
+
+        TMPluginGetInstanceFunc getInstance = reinterpret_cast<TMPluginGetInstanceFunc>(GetProcAddress(module, "TMPluginGetInstance"));
+        if (!getInstance)
+        {
+            std::fwprintf(stderr, L"%s does not export TMPluginGetInstance\n", dllPath);
+            FreeLibrary(module);
+            return 1;
+        }
+        ITMPlugin* plugin = getInstance();
+        QueryPerformanceCounter(&instance);
+
+        // TrafficMonitor asks for data right after loading; this call must not wait for the batteries
+        plugin->DataRequired();
+        QueryPerformanceCounter(&firstCall);
+
+        IPluginItem* item = plugin->GetItem(0);
+        ULONGLONG deadline = GetTickCount64() + FIRST_VALUE_TIMEOUT_MS;
+        bool shown = false;
+        while (!(shown = wcscmp(item->GetItemValueText(), PLACEHOLDER_VALUE) != 0) && GetTickCount64() < deadline)
+            Sleep(1);
+        QueryPerformanceCounter(&firstValue);
+
+        std::wprintf(L"LoadLibrary:           %8.2f ms\n", ElapsedMs(start, loaded));
+        std::wprintf(L"TMPluginGetInstance:   %8.2f ms\n", ElapsedMs(loaded, instance));
+        std::wprintf(L"First DataRequired:    %8.2f ms\n", ElapsedMs(instance, firstCall));
+        if (shown)
+            std::wprintf(L"First value (%s): %8.2f ms after TMPluginGetInstance\n", item->GetItemValueText(), ElapsedMs(loaded, firstValue));
+        else
+            std::wprintf(L"No value within %lu ms\n", FIRST_VALUE_TIMEOUT_MS);
+
+        // Safe while the first sample is still running, it holds its own reference to the DLL
+        FreeLibrary(module);
+        return shown ? 0 : 1;
+    }
+
+    // Average time of one tick and the number of statuses it returned
+    double TimeQueries(std::vector<CBatteryDevices>& devices, size_t& answered)
+    {
+        LARGE_INTEGER start, end;
+        answered = 0;
+        QueryPerformanceCounter(&start);
+        for (int round = 0; round < QUERY_ROUNDS; round++)
+        {
+            for (CBatteryDevices& device : devices)
+            {
+                device.Open();
+                answered += device.QueryStatus(QUERY_TIMEOUT_MS).size();
+            }
+        }
+        QueryPerformanceCounter(&end);
+        answered /= QUERY_ROUNDS;
+        return ElapsedMs(start, end) / QUERY_ROUNDS;
+    }
+
+    int RunDevices(const std::vector<DWORD>& delays)
+    {
+        DWORD slowest = 0, total = 0;
+        for (DWORD delay : delays)
+        {
+            // A battery slower than the timeout is cancelled when the tick gives up on it
+            DWORD waited = delay < QUERY_TIMEOUT_MS ? delay : QUERY_TIMEOUT_MS;
+            if (waited > slowest)
+                slowest = waited;
+            total += waited;
+        }
+
+        // All batteries behind one completion port, as the plugin queries them
+        std::vector<CBatteryDevices> batched(1);
+        batched[0].UseFakeDevices(delays);
+
+        // One battery per instance, so every query waits for the previous one
+        std::vector<CBatteryDevices> sequential(delays.size());
+        for (size_t i = 0; i < delays.size(); i++)
+            sequential[i].UseFakeDevices(std::vector<DWORD>(1, delays[i]));
+
+        size_t batchedAnswered, sequentialAnswered;
+        double batchedMs = TimeQueries(batched, batchedAnswered);
+        double sequentialMs = TimeQueries(sequential, sequentialAnswered);
+
+        std::wprintf(L"%zu batteries, timeout %lu ms, %d rounds\n", delays.size(), QUERY_TIMEOUT_MS, QUERY_ROUNDS);
+        std::wprintf(L"Batched:    %8.2f ms per tick, %zu answered (slowest battery %lu ms)\n", batchedMs, batchedAnswered, slowest);
+        std::wprintf(L"Sequential: %8.2f ms per tick, %zu answered (sum of delays %lu ms)\n", sequentialMs, sequentialAnswered, total);
+        return 0;
+    }
+
+    void PrintUsage()
+    {
+        std::wprintf(L"Usage: BatteryPowerBench startup [path\\to\\BatteryPowerRatePlugin.dll]\n");
+        std::wprintf(L"       BatteryPowerBench devices [delay_ms ...]\n");
+    }
+}
+
+int wmain(int argc, wchar_t* argv[])
+{
+    if (argc < 2)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    if (wcscmp(argv[1], L"startup") == 0)
+        return RunStartup(argc > 2 ? argv[2] : L"plugins\\BatteryPowerRatePlugin.dll");
+
+    if (wcscmp(argv[1], L"devices") == 0)
+    {
+        std::vector<DWORD> delays;
+        for (int i = 2; i < argc; i++)
+        {
+            if (!std::iswdigit(argv[i][0]))
+            {
+                PrintUsage();
+                return 1;
+            }
+            delays.push_back(wcstoul(argv[i], nullptr, 10));
+        }
+        if (delays.empty())
+            delays = { 40, 80, 120 };
+        return RunDevices(delays);
+    }
+
+    PrintUsage();
+    return 1;
+}
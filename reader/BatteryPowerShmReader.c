@@ -0,0 +1,138 @@
+#include "BatteryPowerShmReader.h"
+
+#include <string.h>
+
+/* Failed attempts spent spinning before the reader starts yielding the processor */
+#define SPIN_ATTEMPTS 1000
+
+/* How long a reader waits for the writer to finish an update. Longer than a scheduler quantum,
+ * so a writer preempted between its two increments gets to finish; a writer that died
+ * mid-update never makes the sequence even again. */
+#define BUSY_TIMEOUT_MS 100
+
+int BatteryPowerShmOpen(BatteryPowerShmReader* reader)
+{
+    return BatteryPowerShmOpenNamed(reader, BATTERY_POWER_SHM_NAME);
+}
+
+int BatteryPowerShmOpenNamed(BatteryPowerShmReader* reader, const wchar_t* name)
+{
+    reader->shm = NULL;
+    reader->mapping = OpenFileMapping(FILE_MAP_READ, FALSE, name);
+    if (!reader->mapping)
+        return 0;
+
+    reader->shm = (const BatteryPowerShm*)MapViewOfFile(reader->mapping, FILE_MAP_READ, 0, 0, sizeof(BatteryPowerShm));
+    if (!reader->shm)
+    {
+        CloseHandle(reader->mapping);
+        reader->mapping = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+void BatteryPowerShmClose(BatteryPowerShmReader* reader)
+{
+    if (reader->shm)
+        UnmapViewOfFile(reader->shm);
+    if (reader->mapping)
+        CloseHandle(reader->mapping);
+    reader->shm = NULL;
+    reader->mapping = NULL;
+}
+
+/* Returns the sequence number, odd while an update is in progress. The barrier keeps the
+ * data reads that follow from being performed before the sequence read. */
+static uint32_t BeginRead(const BatteryPowerShm* shm)
+{
+    uint32_t sequence = shm->sequence;
+    MemoryBarrier();
+    return sequence;
+}
+
+/* Returns nonzero when no update started since BeginRead() returned sequence */
+static int EndRead(const BatteryPowerShm* shm, uint32_t sequence)
+{
+    MemoryBarrier();
+    return shm->sequence == sequence;
+}
+
+/* Called after an attempt met an update. Spins at first, then yields to let the writer run.
+ * Returns 0 once BUSY_TIMEOUT_MS have passed since the reader started yielding. */
+static int WaitForWriter(unsigned* attempt, ULONGLONG* yieldStart)
+{
+    ++*attempt;
+    if (*attempt < SPIN_ATTEMPTS)
+    {
+        YieldProcessor();
+        return 1;
+    }
+
+    if (*attempt == SPIN_ATTEMPTS)
+        *yieldStart = GetTickCount64();
+    else if (GetTickCount64() - *yieldStart >= BUSY_TIMEOUT_MS)
+        return 0;
+    if (!SwitchToThread())
+        Sleep(0);
+    return 1;
+}
+
+int BatteryPowerShmReadLatest(const BatteryPowerShmReader* reader, BatteryPowerSample* sample)
+{
+    const BatteryPowerShm* shm = reader->shm;
+    unsigned attempt = 0;
+    ULONGLONG yieldStart = 0;
+    if (!shm)
+        return 0;
+
+    do
+    {
+        uint32_t sequence = BeginRead(shm);
+        int valid;
+        if (sequence & 1)
+            continue;
+
+        valid = shm->magic == BATTERY_POWER_SHM_MAGIC && shm->version == BATTERY_POWER_SHM_VERSION
+            && shm->history_count > 0;
+        memcpy(sample, (const void*)&shm->latest, sizeof(*sample));
+        if (EndRead(shm, sequence))
+            return valid;
+    } while (WaitForWriter(&attempt, &yieldStart));
+    return BATTERY_POWER_SHM_BUSY;
+}
+
+int BatteryPowerShmReadHistory(const BatteryPowerShmReader* reader, BatteryPowerSample* samples, int max_count)
+{
+    const BatteryPowerShm* shm = reader->shm;
+    unsigned attempt = 0;
+    ULONGLONG yieldStart = 0;
+    if (!shm || max_count <= 0)
+        return 0;
+
+    do
+    {
+        uint32_t sequence = BeginRead(shm);
+        uint32_t total, count, i;
+        int valid;
+        if (sequence & 1)
+            continue;
+
+        total = shm->history_count;
+        count = total < BATTERY_POWER_SHM_HISTORY ? total : BATTERY_POWER_SHM_HISTORY;
+        valid = shm->magic == BATTERY_POWER_SHM_MAGIC && shm->version == BATTERY_POWER_SHM_VERSION;
+        if ((uint32_t)max_count < count)
+            count = (uint32_t)max_count;
+
+        /* Oldest of the requested samples first */
+        for (i = 0; i < count; i++)
+        {
+            uint32_t index = (total - count + i) % BATTERY_POWER_SHM_HISTORY;
+            memcpy(&samples[i], (const void*)&shm->history[index], sizeof(samples[i]));
+        }
+
+        if (EndRead(shm, sequence))
+            return valid ? (int)count : 0;
+    } while (WaitForWriter(&attempt, &yieldStart));
+    return BATTERY_POWER_SHM_BUSY;
+}
@@ -0,0 +1,47 @@
+/*
+ * Reader for the shared-memory segment published by BatteryPowerRatePlugin.
+ * Enable "Publish to shared memory" in the plugin's commands first.
+ *
+ * Opening maps the segment once; every read afterwards is a plain memory copy with no
+ * system calls unless it meets the plugin in the middle of an update. Reads then spin, yield
+ * and retry for a bounded time, and never return a torn sample.
+ */
+#ifndef BATTERY_POWER_SHM_READER_H
+#define BATTERY_POWER_SHM_READER_H
+
+#include <Windows.h>
+#include "../BatteryPowerShm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Returned by the read functions when the writer kept the segment busy for too long,
+ * including a writer that died mid-update. Retrying later may succeed. */
+#define BATTERY_POWER_SHM_BUSY (-1)
+
+typedef struct BatteryPowerShmReader
+{
+    HANDLE mapping;
+    const BatteryPowerShm* shm;
+} BatteryPowerShmReader;
+
+/* Maps the segment. Returns 0 when the plugin is not publishing. */
+int BatteryPowerShmOpen(BatteryPowerShmReader* reader);
+/* Same for a segment under another name, e.g. one created by a test */
+int BatteryPowerShmOpenNamed(BatteryPowerShmReader* reader, const wchar_t* name);
+void BatteryPowerShmClose(BatteryPowerShmReader* reader);
+
+/* Copies the newest sample. Returns 1 on success, 0 when nothing has been published yet
+ * and BATTERY_POWER_SHM_BUSY when the writer kept the segment busy. */
+int BatteryPowerShmReadLatest(const BatteryPowerShmReader* reader, BatteryPowerSample* sample);
+
+/* Copies up to max_count of the newest samples, oldest first. Returns the number copied,
+ * or BATTERY_POWER_SHM_BUSY. */
+int BatteryPowerShmReadHistory(const BatteryPowerShmReader* reader, BatteryPowerSample* samples, int max_count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BATTERY_POWER_SHM_READER_H */
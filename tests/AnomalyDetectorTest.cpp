@@ -0,0 +1,206 @@
+#include <Windows.h>
+#include "../AnomalyDetector.h"
+#include "Tests.h"
+
+#include <cmath>
+#include <string>
+
+// Replays synthetic one-sample-per-second discharge traces through CAnomalyDetector:
+// a noisy steady drain, with and without injected steps
+namespace
+{
+    const int HOUR = 10;
+    const double NORMAL_WATTS = 8.0;
+    const double NOISE_WATTS = 1.0;
+
+    // One hour of samples, enough for the hourly baseline to replace the overall one
+    const int TRAINING_SAMPLES = 3600;
+
+    // Gaussian-like noise (sum of twelve uniform values), reproducible across runs
+    struct Trace
+    {
+        unsigned seed = 1;
+
+        double Noise()
+        {
+            double sum = 0;
+            for (int i = 0; i < 12; i++)
+            {
+                seed = seed * 1103515245u + 12345u;
+                sum += ((seed >> 8) & 0xFFFF) / 65536.0;
+            }
+            return (sum - 6) * NOISE_WATTS;
+        }
+
+        double Sample(double offsetWatts) { return NORMAL_WATTS + offsetWatts + Noise(); }
+    };
+
+    // Feeds count samples of the normal drain plus offsetWatts. Returns the index of the first
+    // sample that raised the alert, or -1.
+    int Replay(CAnomalyDetector& detector, Trace& trace, int count, double offsetWatts)
+    {
+        int first = -1;
+        for (int i = 0; i < count; i++)
+        {
+            if (detector.Update(trace.Sample(offsetWatts), HOUR) && first < 0)
+                first = i;
+        }
+        return first;
+    }
+
+    // Feeds samples until the alert is off. Returns how many it took, or -1 after count samples.
+    int ReplayUntilCleared(CAnomalyDetector& detector, Trace& trace, int count, double offsetWatts)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (!detector.Update(trace.Sample(offsetWatts), HOUR))
+                return i;
+        }
+        return -1;
+    }
+
+    void Train(CAnomalyDetector& detector, Trace& trace)
+    {
+        Replay(detector, trace, TRAINING_SAMPLES, 0);
+    }
+
+    bool SameBaseline(const CAnomalyDetector::Baseline& a, const CAnomalyDetector::Baseline& b)
+    {
+        return a.count == b.count && a.mean == b.mean && a.m2 == b.m2;
+    }
+
+    std::wstring GetTestIniPath()
+    {
+        wchar_t directory[MAX_PATH];
+        GetTempPath(_countof(directory), directory);
+        return std::wstring(directory) + L"BatteryPowerTests.ini";
+    }
+}
+
+bool TestDrainSteady()
+{
+    // Four hours of ordinary noise never raise the alert
+    CAnomalyDetector detector;
+    Trace trace;
+    CHECK(Replay(detector, trace, 4 * 3600, 0) == -1);
+    CHECK(std::fabs(detector.GetBaseline(HOUR).mean - NORMAL_WATTS) < 0.1);
+    return true;
+}
+
+bool TestDrainStep()
+{
+    // A step of four or six standard deviations is flagged within tens of seconds
+    const double STEPS[] = { 4.0, 6.0 };
+    const int MAX_DELAY[] = { 40, 25 };
+    for (int i = 0; i < 2; i++)
+    {
+        CAnomalyDetector detector;
+        Trace trace;
+        Train(detector, trace);
+
+        int first = Replay(detector, trace, 600, STEPS[i]);
+        std::printf("  +%.0f W flagged after %d samples\n", STEPS[i], first);
+        CHECK(first >= 0);
+        CHECK(first <= MAX_DELAY[i]);
+        CHECK(detector.IsAlerting());
+
+        // The abnormal samples are kept out of the baseline
+        CHECK(std::fabs(detector.GetBaseline(HOUR).mean - NORMAL_WATTS) < 0.1);
+    }
+    return true;
+}
+
+bool TestDrainClears()
+{
+    CAnomalyDetector detector;
+    Trace trace;
+    Train(detector, trace);
+    CHECK(Replay(detector, trace, 300, 6.0) >= 0);
+
+    // Once the drain is back to normal the capped CUSUM drains within a few minutes
+    int cleared = ReplayUntilCleared(detector, trace, 600, 0);
+    std::printf("  cleared after %d normal samples\n", cleared);
+    CHECK(cleared >= 0);
+    CHECK(cleared <= 300);
+    CHECK(Replay(detector, trace, 3600, 0) == -1);
+
+    // Running on AC clears a raised alert at once
+    CHECK(Replay(detector, trace, 300, 6.0) >= 0);
+    CHECK(!detector.Update(0, HOUR));
+    return true;
+}
+
+bool TestDrainRelearn()
+{
+    // A lasting heavier workload is flagged for about half an hour, then learned as normal
+    CAnomalyDetector detector;
+    Trace trace;
+    Train(detector, trace);
+    CHECK(Replay(detector, trace, 60, 4.0) >= 0);
+    CHECK(ReplayUntilCleared(detector, trace, 1500, 4.0) == -1);
+
+    int cleared = ReplayUntilCleared(detector, trace, 2 * 3600, 4.0);
+    std::printf("  learned after %d more samples\n", cleared);
+    CHECK(cleared >= 0);
+    CHECK(Replay(detector, trace, 3600, 4.0) == -1);
+    CHECK(std::fabs(detector.GetBaseline(HOUR).mean - (NORMAL_WATTS + 4.0)) < 0.5);
+    return true;
+}
+
+bool TestDrainAcknowledge()
+{
+    CAnomalyDetector detector;
+    Trace trace;
+    Train(detector, trace);
+    CHECK(Replay(detector, trace, 120, 6.0) >= 0);
+
+    // An acknowledged drain is not flagged again and the baseline moves most of the way to it
+    detector.Acknowledge();
+    CHECK(!detector.IsAlerting());
+    CHECK(Replay(detector, trace, 3600, 6.0) == -1);
+    CHECK(detector.GetBaseline(HOUR).mean > NORMAL_WATTS + 4.0);
+
+    // After a run on AC a later step is judged against the new baseline
+    detector.Update(0, HOUR);
+    CHECK(Replay(detector, trace, 600, 6.0 + 6.0) >= 0);
+    return true;
+}
+
+bool TestDrainSaveLoad()
+{
+    const std::wstring path = GetTestIniPath();
+    DeleteFile(path.c_str());
+
+    // Distinct baselines for a few hours and the overall one
+    CAnomalyDetector saved;
+    Trace trace;
+    for (int hour = 5; hour <= 8; hour++)
+    {
+        for (int i = 0; i < TRAINING_SAMPLES; i++)
+            saved.Update(trace.Sample(hour - 5.0), hour);
+    }
+    saved.Save(path.c_str());
+
+    CAnomalyDetector loaded;
+    loaded.Load(path.c_str());
+    for (int hour = 5; hour <= 8; hour++)
+        CHECK(SameBaseline(loaded.GetBaseline(hour), saved.GetBaseline(hour)));
+    CHECK(SameBaseline(loaded.GetBaseline(0), saved.GetBaseline(0)));
+
+    // Damaged entries are skipped, those hours fall back to the overall baseline
+    WritePrivateProfileString(L"drain_baseline", L"h05", L"garbage", path.c_str());
+    WritePrivateProfileString(L"drain_baseline", L"h06", L"-1,8,100", path.c_str());
+    WritePrivateProfileString(L"drain_baseline", L"h07", L"3600,8,-5", path.c_str());
+    WritePrivateProfileString(L"drain_baseline", L"h08", L"1e12,8,100", path.c_str());
+    CAnomalyDetector damaged;
+    damaged.Load(path.c_str());
+    for (int hour = 5; hour <= 8; hour++)
+        CHECK(&damaged.GetBaseline(hour) == &damaged.GetBaseline(0));
+    CHECK(SameBaseline(damaged.GetBaseline(0), saved.GetBaseline(0)));
+
+    // A file without the section keeps the current baselines
+    DeleteFile(path.c_str());
+    loaded.Load(path.c_str());
+    CHECK(SameBaseline(loaded.GetBaseline(5), saved.GetBaseline(5)));
+    return true;
+}
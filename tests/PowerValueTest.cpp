@@ -0,0 +1,119 @@
+#include <Windows.h>
+#include "../PowerValue.h"
+#include "Tests.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cwchar>
+
+// Runs the steps of the sample pipeline once with FixedPowerWatts and once with
+// FloatPowerWatts on the same battery readings and compares the results
+namespace
+{
+    const int TRIAL_COUNT = 200000;
+
+    // Readings of up to +-100 W in milliwatts, as IOCTL_BATTERY_QUERY_STATUS reports them
+    long NextRateMilliwatts(unsigned& seed)
+    {
+        seed = seed * 1103515245u + 12345u;
+        return static_cast<long>((seed >> 8) % 200001) - 100000;
+    }
+
+    // The pipeline's smoothing: the sum of three readings divided by their count
+    template <typename Power>
+    Power Average(const long (&rates)[3])
+    {
+        Power sum;
+        for (long rate : rates)
+            sum += Power::FromUnits(rate, 1000);
+        return sum / 3;
+    }
+}
+
+bool TestPowerValueAverage()
+{
+    // Fixed point rounds the average to whole milliwatts, half away from zero
+    unsigned seed = 1;
+    for (int trial = 0; trial < TRIAL_COUNT; trial++)
+    {
+        long rates[3] = { NextRateMilliwatts(seed), NextRateMilliwatts(seed), NextRateMilliwatts(seed) };
+        double fixed = Average<FixedPowerWatts>(rates).ToDouble();
+        double floating = Average<FloatPowerWatts>(rates).ToDouble();
+        CHECK(std::fabs(fixed - floating) <= 0.0005 + 1e-9);
+    }
+    return true;
+}
+
+bool TestPowerValueThreshold()
+{
+    // Both decide "near zero" alike unless the exact average lies within the fixed-point rounding
+    const FixedPowerWatts fixedLimit = FixedPowerWatts::FromUnits(50, 1000);
+    const FloatPowerWatts floatLimit = FloatPowerWatts::FromUnits(50, 1000);
+    unsigned seed = 2;
+    int differing = 0;
+    for (int trial = 0; trial < TRIAL_COUNT; trial++)
+    {
+        // Small readings so the threshold is actually crossed
+        long rates[3];
+        for (long& rate : rates)
+            rate = NextRateMilliwatts(seed) % 200;
+
+        bool fixedNearZero = Average<FixedPowerWatts>(rates).Abs() < fixedLimit;
+        bool floatNearZero = Average<FloatPowerWatts>(rates).Abs() < floatLimit;
+        if (fixedNearZero != floatNearZero)
+        {
+            double exact = std::fabs((rates[0] + rates[1] + rates[2]) / 3.0);
+            CHECK(std::fabs(exact - 50) < 0.5);
+            ++differing;
+        }
+    }
+    std::printf("  %d of %d threshold decisions differ at the rounding boundary\n", differing, TRIAL_COUNT);
+    return true;
+}
+
+bool TestPowerValueFormat()
+{
+    // The text matches "%.2f" except where the double is a hair below a rounding tie. The
+    // pipeline formats magnitudes only, the direction is shown by the unit.
+    unsigned seed = 3;
+    for (int trial = 0; trial < TRIAL_COUNT; trial++)
+    {
+        long rate = NextRateMilliwatts(seed);
+        wchar_t fixed[24], floating[24];
+        FixedPowerWatts::FromUnits(rate, 1000).Abs().Format(fixed, _countof(fixed), 2);
+        FloatPowerWatts::FromUnits(rate, 1000).Abs().Format(floating, _countof(floating), 2);
+        if (std::labs(rate % 10) == 5)
+            CHECK(std::fabs(wcstod(fixed, nullptr) - wcstod(floating, nullptr)) <= 0.01 + 1e-9);
+        else
+            CHECK(wcscmp(fixed, floating) == 0);
+    }
+
+    wchar_t text[24];
+    FixedPowerWatts::FromUnits(-5, 1000).Format(text, _countof(text), 2);
+    CHECK(wcscmp(text, L"-0.01") == 0);
+    FixedPowerWatts::FromUnits(12345, 1000).Format(text, _countof(text), 2);
+    CHECK(wcscmp(text, L"12.35") == 0);
+    return true;
+}
+
+bool TestPowerValueEnergy()
+{
+    // Eight hours of one-second samples; the fixed-point sum is exact, the double one drifts
+    unsigned seed = 4;
+    FixedEnergyWattHours fixed;
+    FloatEnergyWattHours floating;
+    long long exactMilliwattMs = 0;
+    for (int second = 0; second < 8 * 3600; second++)
+    {
+        long rate = NextRateMilliwatts(seed);
+        fixed += IntegrateEnergy(FixedPowerWatts::FromUnits(rate, 1000), 1000);
+        floating += IntegrateEnergy(FloatPowerWatts::FromUnits(rate, 1000), 1000);
+        exactMilliwattMs += static_cast<long long>(rate) * 1000;
+    }
+
+    CHECK(fixed.Raw() == exactMilliwattMs);
+    double difference = std::fabs(fixed.ToDouble() - floating.ToDouble());
+    std::printf("  fixed %.9f Wh, double %.9f Wh, difference %.3g Wh\n", fixed.ToDouble(), floating.ToDouble(), difference);
+    CHECK(difference < 1e-6);
+    return true;
+}
@@ -0,0 +1,168 @@
+#include "../ProcessPowerAttribution.h"
+#include "Tests.h"
+
+#include <set>
+
+// Drives the PID table of CProcessPowerAttribution directly, with a small table so probe
+// chains wrap around its end and grow after a few insertions
+struct ProcessTableTest
+{
+    CProcessPowerAttribution table;
+
+    explicit ProcessTableTest(size_t capacity)
+    {
+        table.m_slots.resize(capacity);
+    }
+
+    size_t Capacity() const { return table.m_slots.size(); }
+    size_t Count() const { return table.m_count; }
+    size_t Home(DWORD pid) const { return table.HomeIndex(pid); }
+    size_t IndexOf(DWORD pid) const { return table.Find(pid); }
+    bool Contains(DWORD pid) const { return IndexOf(pid) != SIZE_MAX; }
+
+    // Same load limit as Update()
+    void Insert(DWORD pid)
+    {
+        if ((table.m_count + 1) * 2 > table.m_slots.size())
+            table.Grow();
+        table.Insert(pid);
+    }
+
+    void Erase(DWORD pid) { table.Erase(table.Find(pid)); }
+
+    // PIDs (multiples of 4, as on Windows) whose home is the given slot
+    std::vector<DWORD> PidsWithHome(size_t home, size_t count, DWORD& nextPid) const
+    {
+        std::vector<DWORD> pids;
+        for (; pids.size() < count; nextPid += 4)
+        {
+            if (Home(nextPid) == home)
+                pids.push_back(nextPid);
+        }
+        return pids;
+    }
+};
+
+namespace
+{
+    bool ContainsAll(const ProcessTableTest& test, const std::set<DWORD>& pids)
+    {
+        for (DWORD pid : pids)
+        {
+            if (!test.Contains(pid))
+                return false;
+        }
+        return test.Count() == pids.size();
+    }
+}
+
+bool TestProcessTableWrap()
+{
+    ProcessTableTest test(16);
+    const size_t last = test.Capacity() - 1;
+
+    // Three PIDs homed in the last slot occupy it and then slots 0 and 1. A PID homed in
+    // slot 0 is pushed behind them.
+    DWORD nextPid = 4;
+    std::vector<DWORD> wrapped = test.PidsWithHome(last, 3, nextPid);
+    nextPid = 4;
+    std::vector<DWORD> first = test.PidsWithHome(0, 1, nextPid);
+    std::set<DWORD> pids;
+    for (DWORD pid : wrapped)
+    {
+        test.Insert(pid);
+        pids.insert(pid);
+    }
+    test.Insert(first[0]);
+    pids.insert(first[0]);
+    CHECK(test.Capacity() == 16);
+    CHECK(ContainsAll(test, pids));
+
+    // Erasing the head of the chain shifts the others back across the wrap boundary
+    test.Erase(wrapped[0]);
+    pids.erase(wrapped[0]);
+    CHECK(!test.Contains(wrapped[0]));
+    CHECK(ContainsAll(test, pids));
+
+    // The PID homed in slot 0 must not move in front of its home
+    test.Erase(wrapped[1]);
+    pids.erase(wrapped[1]);
+    CHECK(ContainsAll(test, pids));
+    CHECK(test.IndexOf(first[0]) == 0);
+
+    test.Erase(first[0]);
+    pids.erase(first[0]);
+    CHECK(ContainsAll(test, pids));
+    test.Erase(wrapped[2]);
+    pids.erase(wrapped[2]);
+    CHECK(test.Count() == 0);
+    return true;
+}
+
+bool TestProcessTableGrow()
+{
+    ProcessTableTest test(16);
+    const size_t last = test.Capacity() - 1;
+
+    // Fill the table to its load limit with a chain wrapping around the end, then grow it
+    DWORD nextPid = 4;
+    std::vector<DWORD> colliding = test.PidsWithHome(last, 4, nextPid);
+    std::set<DWORD> pids;
+    for (DWORD pid : colliding)
+    {
+        test.Insert(pid);
+        pids.insert(pid);
+    }
+    for (DWORD pid = 4; pids.size() < test.Capacity() / 2; pid += 4)
+    {
+        if (pids.insert(pid).second)
+            test.Insert(pid);
+    }
+    CHECK(test.Capacity() == 16);
+    CHECK(ContainsAll(test, pids));
+
+    const DWORD extraPid = 0x100000;
+    CHECK(pids.count(extraPid) == 0);
+    test.Insert(extraPid);
+    pids.insert(extraPid);
+    CHECK(test.Capacity() == 32);
+    CHECK(ContainsAll(test, pids));
+
+    // Erasing after the grow still keeps every chain intact
+    for (DWORD pid : colliding)
+    {
+        test.Erase(pid);
+        pids.erase(pid);
+        CHECK(ContainsAll(test, pids));
+    }
+    return true;
+}
+
+bool TestProcessTableChurn()
+{
+    // Processes start and exit in random order, as they do between scans
+    ProcessTableTest test(16);
+    std::set<DWORD> pids;
+    unsigned seed = 7;
+    for (int step = 0; step < 200000; step++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        DWORD pid = ((seed >> 8) % 512 + 1) * 4;
+        if (pids.count(pid))
+        {
+            test.Erase(pid);
+            pids.erase(pid);
+        }
+        else
+        {
+            test.Insert(pid);
+            pids.insert(pid);
+        }
+        if (step % 1000 == 0)
+            CHECK(ContainsAll(test, pids));
+    }
+    CHECK(ContainsAll(test, pids));
+    for (DWORD pid = 4; pid <= 4 * 513; pid += 4)
+        CHECK(test.Contains(pid) == (pids.count(pid) != 0));
+    return true;
+}
@@ -0,0 +1,217 @@
+#include "../ShmPublisher.h"
+#include "../reader/BatteryPowerShmReader.h"
+#include "Tests.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // A separate name so the tests never touch the segment of a running plugin
+    const wchar_t* const TEST_SHM_NAME = L"Local\\BatteryPowerRatePluginTest";
+
+    const int READER_COUNT = 4;
+    const ULONGLONG WRITE_DURATION_MS = 1000;
+
+    // Every field is derived from the time, so a sample mixing two writes is detected
+    BatteryPowerSample MakeSample(uint32_t n)
+    {
+        BatteryPowerSample sample = {};
+        sample.time_ms = n;
+        sample.battery_rate_mw = -static_cast<int32_t>(n % 100000);
+        sample.system_power_mw = static_cast<int32_t>(n % 100000) * 3;
+        sample.flags = n * 2654435761u;
+        sample.reserved = ~n;
+        return sample;
+    }
+
+    bool IsConsistent(const BatteryPowerSample& sample)
+    {
+        BatteryPowerSample expected = MakeSample(static_cast<uint32_t>(sample.time_ms));
+        return sample.time_ms >= 0
+            && sample.battery_rate_mw == expected.battery_rate_mw
+            && sample.system_power_mw == expected.system_power_mw
+            && sample.flags == expected.flags
+            && sample.reserved == expected.reserved;
+    }
+
+    struct ReaderStats
+    {
+        uint32_t reads = 0;
+        uint32_t torn = 0;
+        uint32_t backwards = 0;
+    };
+
+    void ReadUntilDone(const std::atomic<bool>& done, ReaderStats& stats)
+    {
+        BatteryPowerShmReader reader;
+        if (!BatteryPowerShmOpenNamed(&reader, TEST_SHM_NAME))
+        {
+            ++stats.torn;
+            return;
+        }
+
+        BatteryPowerSample history[BATTERY_POWER_SHM_HISTORY];
+        int64_t lastTime = -1;
+        while (!done.load())
+        {
+            BatteryPowerSample latest;
+            if (BatteryPowerShmReadLatest(&reader, &latest) == 1)
+            {
+                ++stats.reads;
+                if (!IsConsistent(latest))
+                    ++stats.torn;
+                if (latest.time_ms < lastTime)
+                    ++stats.backwards;
+                lastTime = latest.time_ms;
+            }
+
+            // A consistent history is a run of consecutive samples
+            int count = BatteryPowerShmReadHistory(&reader, history, BATTERY_POWER_SHM_HISTORY);
+            for (int i = 0; i < count; i++)
+            {
+                if (!IsConsistent(history[i]) || (i > 0 && history[i].time_ms != history[i - 1].time_ms + 1))
+                {
+                    ++stats.torn;
+                    break;
+                }
+            }
+        }
+        BatteryPowerShmClose(&reader);
+    }
+}
+
+bool TestShmTornReads()
+{
+    CShmPublisher publisher(TEST_SHM_NAME);
+    CHECK(publisher.Publish(MakeSample(0)));
+
+    std::atomic<bool> done(false);
+    std::vector<ReaderStats> stats(READER_COUNT);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < READER_COUNT; i++)
+        readers.emplace_back(ReadUntilDone, std::cref(done), std::ref(stats[i]));
+
+    // Publish back to back, far faster than the plugin ever does
+    uint32_t published = 0;
+    for (ULONGLONG start = GetTickCount64(); GetTickCount64() - start < WRITE_DURATION_MS; )
+    {
+        for (int i = 0; i < 1000; i++)
+            publisher.Publish(MakeSample(++published));
+    }
+
+    done = true;
+    for (std::thread& reader : readers)
+        reader.join();
+
+    uint32_t reads = 0;
+    for (const ReaderStats& reader : stats)
+    {
+        CHECK(reader.torn == 0);
+        CHECK(reader.backwards == 0);
+        reads += reader.reads;
+    }
+    std::printf("  %u consistent reads by %d readers during %u writes\n", reads, READER_COUNT, published);
+    CHECK(reads > 0);
+    return true;
+}
+
+bool TestShmDeadWriter()
+{
+    CShmPublisher publisher(TEST_SHM_NAME);
+    CHECK(publisher.Publish(MakeSample(1)));
+
+    BatteryPowerShmReader reader;
+    CHECK(BatteryPowerShmOpenNamed(&reader, TEST_SHM_NAME));
+
+    // Leave the sequence odd, as a writer killed between its two increments would
+    HANDLE mapping = OpenFileMapping(FILE_MAP_WRITE, FALSE, TEST_SHM_NAME);
+    CHECK(mapping != NULL);
+    BatteryPowerShm* shm = static_cast<BatteryPowerShm*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, sizeof(BatteryPowerShm)));
+    CHECK(shm != nullptr);
+    InterlockedIncrement(reinterpret_cast<volatile LONG*>(&shm->sequence));
+    publisher.Close();
+
+    // Readers must report the segment as busy, not as empty, and give up in bounded time
+    BatteryPowerSample sample;
+    BatteryPowerSample history[BATTERY_POWER_SHM_HISTORY];
+    ULONGLONG start = GetTickCount64();
+    int latest = BatteryPowerShmReadLatest(&reader, &sample);
+    int count = BatteryPowerShmReadHistory(&reader, history, BATTERY_POWER_SHM_HISTORY);
+    ULONGLONG elapsed = GetTickCount64() - start;
+
+    CHECK(latest == BATTERY_POWER_SHM_BUSY);
+    CHECK(count == BATTERY_POWER_SHM_BUSY);
+    CHECK(elapsed < 1000);
+
+    // A restarted writer repairs the sequence; the open view keeps the old segment alive
+    CShmPublisher restarted(TEST_SHM_NAME);
+    CHECK(restarted.Publish(MakeSample(2)));
+    CHECK(BatteryPowerShmReadLatest(&reader, &sample) == 1);
+    CHECK(sample.time_ms == 2);
+    CHECK(BatteryPowerShmReadHistory(&reader, history, BATTERY_POWER_SHM_HISTORY) == 2);
+
+    UnmapViewOfFile(shm);
+    CloseHandle(mapping);
+    BatteryPowerShmClose(&reader);
+    return true;
+}
+
+bool TestShmWriterPreempted()
+{
+    CShmPublisher publisher(TEST_SHM_NAME);
+    CHECK(publisher.Publish(MakeSample(1)));
+
+    BatteryPowerShmReader reader;
+    CHECK(BatteryPowerShmOpenNamed(&reader, TEST_SHM_NAME));
+
+    // A writer descheduled mid-update for a scheduler quantum delays readers, it does not fail them
+    HANDLE mapping = OpenFileMapping(FILE_MAP_WRITE, FALSE, TEST_SHM_NAME);
+    CHECK(mapping != NULL);
+    BatteryPowerShm* shm = static_cast<BatteryPowerShm*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, sizeof(BatteryPowerShm)));
+    CHECK(shm != nullptr);
+    InterlockedIncrement(reinterpret_cast<volatile LONG*>(&shm->sequence));
+    std::thread writer([shm]() {
+        Sleep(20);
+        InterlockedIncrement(reinterpret_cast<volatile LONG*>(&shm->sequence));
+    });
+
+    BatteryPowerSample sample;
+    int latest = BatteryPowerShmReadLatest(&reader, &sample);
+    writer.join();
+
+    UnmapViewOfFile(shm);
+    CloseHandle(mapping);
+    BatteryPowerShmClose(&reader);
+
+    CHECK(latest == 1);
+    CHECK(sample.time_ms == 1);
+    return true;
+}
+
+bool TestShmSingleWriter()
+{
+    CShmPublisher first(TEST_SHM_NAME);
+    CHECK(first.Publish(MakeSample(1)));
+
+    // A second publisher must not touch the segment while the first one owns it
+    CShmPublisher second(TEST_SHM_NAME);
+    CHECK(!second.Publish(MakeSample(100)));
+    CHECK(first.Publish(MakeSample(2)));
+
+    BatteryPowerShmReader reader;
+    CHECK(BatteryPowerShmOpenNamed(&reader, TEST_SHM_NAME));
+    BatteryPowerSample sample;
+    CHECK(BatteryPowerShmReadLatest(&reader, &sample) == 1);
+    CHECK(sample.time_ms == 2);
+    CHECK((reader.shm->sequence & 1) == 0);
+
+    // Once the owner is gone the next publisher takes over
+    first.Close();
+    CHECK(second.Publish(MakeSample(3)));
+    CHECK(BatteryPowerShmReadLatest(&reader, &sample) == 1);
+    CHECK(sample.time_ms == 3);
+    BatteryPowerShmClose(&reader);
+    return true;
+}
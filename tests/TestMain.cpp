@@ -0,0 +1,46 @@
+#include <Windows.h>
+#include "Tests.h"
+
+namespace
+{
+    struct TestCase
+    {
+        const char* name;
+        bool (*run)();
+    };
+
+    const TestCase TESTS[] = {
+        { "ShmTornReads", TestShmTornReads },
+        { "ShmDeadWriter", TestShmDeadWriter },
+        { "ShmWriterPreempted", TestShmWriterPreempted },
+        { "ShmSingleWriter", TestShmSingleWriter },
+        { "PowerValueAverage", TestPowerValueAverage },
+        { "PowerValueThreshold", TestPowerValueThreshold },
+        { "PowerValueFormat", TestPowerValueFormat },
+        { "PowerValueEnergy", TestPowerValueEnergy },
+        { "ProcessTableWrap", TestProcessTableWrap },
+        { "ProcessTableGrow", TestProcessTableGrow },
+        { "ProcessTableChurn", TestProcessTableChurn },
+        { "DrainSteady", TestDrainSteady },
+        { "DrainStep", TestDrainStep },
+        { "DrainClears", TestDrainClears },
+        { "DrainRelearn", TestDrainRelearn },
+        { "DrainAcknowledge", TestDrainAcknowledge },
+        { "DrainSaveLoad", TestDrainSaveLoad },
+    };
+}
+
+int main()
+{
+    int failed = 0;
+    for (const TestCase& test : TESTS)
+    {
+        ULONGLONG start = GetTickCount64();
+        bool passed = test.run();
+        std::printf("%s %s (%llu ms)\n", passed ? "PASS" : "FAIL", test.name, GetTickCount64() - start);
+        if (!passed)
+            ++failed;
+    }
+    std::printf("%d of %d tests failed\n", failed, static_cast<int>(_countof(TESTS)));
+    return failed == 0 ? 0 : 1;
+}
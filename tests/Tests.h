@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdio>
+
+// Minimal checks for the console test runner; a failed check fails the running test
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::printf("  %s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            return false; \
+        } \
+    } while (0)
+
+bool TestShmTornReads();
+bool TestShmDeadWriter();
+bool TestShmWriterPreempted();
+bool TestShmSingleWriter();
+bool TestPowerValueAverage();
+bool TestPowerValueThreshold();
+bool TestPowerValueFormat();
+bool TestPowerValueEnergy();
+bool TestProcessTableWrap();
+bool TestProcessTableGrow();
+bool TestProcessTableChurn();
+bool TestDrainSteady();
+bool TestDrainStep();
+bool TestDrainClears();
+bool TestDrainRelearn();
+bool TestDrainAcknowledge();
+bool TestDrainSaveLoad();